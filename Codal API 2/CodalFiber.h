@@ -344,6 +344,13 @@ namespace codal
    */
   void idle_task();
 
+  /**
+   * Time the processor has spent in target_scheduler_idle() since power on.
+   *
+   * @return microseconds spent waiting for an interrupt with no fiber to run.
+   */
+  CODAL_TIMESTAMP fiber_idle_time_us();
+
   /**
    * Determines if deep sleep is pending.
    *
@@ -0,0 +1,121 @@
+#ifndef CODAL_SLAB_ALLOCATOR_H
+#define CODAL_SLAB_ALLOCATOR_H
+
+#include "CodalConfig.h"
+
+/**
+  * Fixed size object pools for small, frequently created objects.
+  *
+  * Each size class owns a list of slabs. A slab is one device_malloc() block holding
+  * SLAB_OBJECTS_PER_SLAB objects and a bitmap of its free slots, so allocation and release
+  * are a count-trailing-zeros and a bit flip instead of a first-fit heap scan, and short lived
+  * objects stop fragmenting the shared heap.
+  *
+  * Every object is preceded by a tag word naming its slab (or SLAB_HEAP_TAG for requests
+  * that fell through to the heap), so slab_free() finds where a pointer goes without a search.
+  */
+
+#ifndef SLAB_OBJECTS_PER_SLAB
+#define SLAB_OBJECTS_PER_SLAB 32 // One bit per object in a uint32_t free map
+#endif
+
+#define SLAB_SIZE_CLASSES 5
+#define SLAB_MAX_OBJECT_SIZE 256 // Larger requests fall through to device_malloc()
+#define SLAB_TAG_BYTES sizeof(void *)
+#define SLAB_HEAP_TAG ((uintptr_t)1)
+
+namespace codal
+{
+    struct SlabStats
+    {
+        uint16_t objectSize; // Size class in bytes
+        uint16_t slabs;      // Slabs currently allocated
+        uint16_t inUse;      // Objects currently allocated
+        uint16_t highWater;  // Largest inUse seen
+        uint32_t allocs;     // Total successful allocations
+        uint32_t failures;   // Allocations that could not get a new slab
+    };
+
+    class SlabPool
+    {
+        struct Slab
+        {
+            Slab *next;
+            SlabPool *pool;
+            uint32_t freeMap; // Bit set for every free slot
+            uint8_t *objects; // Slots of SLAB_TAG_BYTES + objectSize, each tag pointing back here
+        };
+
+        Slab *slabs;
+        Slab *hint; // Last slab known to have a free slot
+        uint16_t stride;
+
+        Slab *grow();
+        Slab *findFree();
+        Slab *owner(void *p);
+        void release(Slab *s, void *p);
+
+        friend void slab_free(void *p);
+
+    public:
+        SlabStats stats;
+
+        /**
+          * Create a pool handing out objects of the given size.
+          *
+          * @param objectSize The size of every object, in bytes.
+          */
+        SlabPool(uint16_t objectSize);
+
+        /**
+          * Allocate one object.
+          *
+          * @return A pointer to the object, or NULL if no slab could be allocated.
+          */
+        void *alloc();
+
+        /**
+          * Return an object to its slab.
+          *
+          * @return true if the object belonged to this pool.
+          */
+        bool free(void *p);
+
+        /**
+          * Determine if the given pointer was allocated from this pool.
+          */
+        bool owns(void *p) { return owner(p) != NULL; }
+    };
+
+    /**
+      * Allocate from the smallest size class that fits, or from the heap if size exceeds SLAB_MAX_OBJECT_SIZE.
+      * Safe to call from interrupt context.
+      */
+    void *slab_malloc(size_t size);
+
+    /**
+      * Release memory obtained with slab_malloc(), and only that: the tag in front of it is trusted.
+      */
+    void slab_free(void *p);
+
+    /**
+      * Retrieve the usage statistics of size class i (0 .. SLAB_SIZE_CLASSES - 1).
+      *
+      * @return The statistics, or NULL for an invalid index.
+      */
+    const SlabStats *slab_stats(int i);
+
+    /**
+      * Print the usage of every size class to DMESG.
+      */
+    void slab_dump();
+}
+
+/**
+  * Adds class specific operator new/delete that route through the slab allocator.
+  */
+#define SLAB_ALLOCATED                                                  \
+    void *operator new(size_t size) { return codal::slab_malloc(size); } \
+    void operator delete(void *p) { codal::slab_free(p); }
+
+#endif
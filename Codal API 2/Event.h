@@ -26,6 +26,7 @@ DEALINGS IN THE SOFTWARE.
 #define CODAL_EVENT_H
 
 #include "CodalConfig.h"
+#include "CodalSlabAllocator.h"
 
 // Wildcard event codes
 #define DEVICE_ID_ANY         0
@@ -129,6 +130,9 @@ namespace codal
           * @param evt The event to be queued.
           */
         EventQueueItem(Event evt);
+
+        // Queue items are created and destroyed for every deferred event, so keep them off the heap.
+        SLAB_ALLOCATED
     };
 }
 
@@ -69,6 +69,7 @@ namespace codal
         uint16_t delta;
 #endif
         LowLevelTimer& timer;
+        bool deepSleeping; // Between deepSleepBegin and deepSleepEnd, the counter is tracked by the caller
 
         /**
           * Synchronises low level timer counter with ours.
@@ -209,6 +210,20 @@ namespace codal
          */
         void deepSleepEnd( CODAL_TIMESTAMP counter, CODAL_TIMESTAMP micros);
 
+        /**
+         * Called from power manager during sleep: interrupt the core `micros` from now.
+         * A 16 bit counter reaches at most one wrap ahead, so the wake-up may come sooner.
+         * @return the microseconds actually armed.
+         */
+        CODAL_TIMESTAMP deepSleepWakeIn( CODAL_TIMESTAMP micros);
+
+        /**
+         * Called from power manager during sleep, at least once per counter wrap.
+         * @param counter the counter last read, updated to the current one
+         * @return microseconds elapsed since `counter`
+         */
+        CODAL_TIMESTAMP deepSleepElapsed( CODAL_TIMESTAMP &counter);
+
         /**
          * Determine the time of the next wake up event.
          * @param timestamp reference to a variable to receive the time.
@@ -216,6 +231,12 @@ namespace codal
          */
         bool deepSleepWakeUpTime( CODAL_TIMESTAMP &timestamp);
 
+        /**
+         * Called from power manager after the core clock changed.
+         * Accounts for the time counted at the old rate, then restores the 1 MHz count.
+         */
+        void clockChanged();
+
         /**
           * Enables interrupts for this timer instance.
           */
@@ -234,6 +255,7 @@ namespace codal
         TimerEvent *timerEventList;
         TimerEvent *nextTimerEvent;
         int eventListSize;
+        uint32_t timerEventFree; // Bit set for every unused slot of timerEventList
 
         TimerEvent *getTimerEvent();
         void releaseTimerEvent(TimerEvent *event);
@@ -401,6 +423,28 @@ namespace codal
      */
     bool system_timer_deepsleep_wakeup_time( CODAL_TIMESTAMP &timestamp);
 
+    /**
+     * While in deep sleep, arm the timer to interrupt the core `micros` from now.
+     * @return the microseconds actually armed, at most one counter wrap; 0 if no timer has been registered.
+     */
+    CODAL_TIMESTAMP system_timer_deepsleep_wake_in( CODAL_TIMESTAMP micros);
+
+    /**
+     * While in deep sleep, measure the time passed since the counter was last read.
+     * Call at least once per counter wrap.
+     * @param counter the counter last read, updated to the current one
+     * @return microseconds elapsed
+     */
+    CODAL_TIMESTAMP system_timer_deepsleep_elapsed( CODAL_TIMESTAMP &counter);
+
+    /**
+     * Rescale the system timer and the cycle counting used by system_timer_wait_us
+     * after the core clock frequency changed.
+     *
+     * @return DEVICE_OK or DEVICE_NOT_SUPPORTED if no timer has been registered.
+     */
+    int system_timer_clock_changed();
+
     extern Timer* system_timer;
 }
 
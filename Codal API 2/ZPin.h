@@ -115,6 +115,12 @@ public:
      */
     ZPin(int id, PinNumber name, PinCapability capability);
 
+    /**
+     * Re-applies the period and pulse of every PWM output after the core clock changed,
+     * since the timer prescalers were computed from the old bus clock.
+     */
+    static void clockChanged();
+
     /**
      * Configures this IO pin as a digital output (if necessary) and sets the pin to 'value'.
      *
@@ -67,6 +67,12 @@ public:
     static void _complete(uint32_t instance);
     static void _irq(uint32_t instance);
 
+    /**
+     * Recompute the baud rate prescaler of every SPI instance before its next transfer.
+     * Call after the peripheral clocks changed.
+     */
+    static void clockChanged();
+
     /**
      * Initialize SPI instance with given pins.
      *
@@ -48,6 +48,7 @@ static Fiber *runQueue = NULL;                     // The list of runnable fiber
 static Fiber *sleepQueue = NULL;                   // The list of blocked fibers waiting on a fiber_sleep() operation.
 static Fiber *waitQueue = NULL;                    // The list of blocked fibers waiting on an event.
 static Fiber *fiberPool = NULL;                    // Pool of unused fibers, just waiting for a job to do.
+static CODAL_TIMESTAMP idleTimeUs = 0;             // Time spent in target_scheduler_idle().
 static Fiber *fiberList = NULL;                    // List of all active Fibers (excludes those in the fiberPool)
 
 /*
@@ -791,10 +792,17 @@ void codal::idle()
         // because we enforce MESSAGE_BUS_LISTENER_IMMEDIATE for listeners placed
         // on the scheduler.
         fiber_flags &= ~DEVICE_SCHEDULER_IDLE;
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
         target_scheduler_idle();
+        idleTimeUs += system_timer_current_time_us() - start;
     }
 }
 
+CODAL_TIMESTAMP codal::fiber_idle_time_us()
+{
+    return idleTimeUs;
+}
+
 void codal::idle_task()
 {
     while(1)
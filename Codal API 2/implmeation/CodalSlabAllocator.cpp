@@ -0,0 +1,178 @@
+#include "CodalConfig.h"
+#include "CodalSlabAllocator.h"
+#include "CodalHeapAllocator.h"
+#include "CodalDmesg.h"
+#include "codal_target_hal.h"
+#include <string.h>
+
+#define SLAB_FULL_MAP (0xFFFFFFFFUL >> (32 - SLAB_OBJECTS_PER_SLAB))
+
+using namespace codal;
+
+static SlabPool slabClasses[SLAB_SIZE_CLASSES] = {
+    SlabPool(16), SlabPool(32), SlabPool(64), SlabPool(128), SlabPool(SLAB_MAX_OBJECT_SIZE)
+};
+
+SlabPool::SlabPool(uint16_t objectSize)
+{
+    this->slabs = NULL;
+    this->hint = NULL;
+    memset(&stats, 0, sizeof(stats));
+    stats.objectSize = (objectSize + 3) & ~3; // keep objects word aligned
+    stride = SLAB_TAG_BYTES + stats.objectSize;
+}
+
+static inline uintptr_t &tagOf(void *p)
+{
+    return *(uintptr_t *)((uint8_t *)p - SLAB_TAG_BYTES);
+}
+
+SlabPool::Slab *SlabPool::grow()
+{
+    Slab *s = (Slab *)device_malloc(sizeof(Slab) + stride * SLAB_OBJECTS_PER_SLAB);
+    if (s == NULL)
+        return NULL;
+
+    s->pool = this;
+    s->objects = (uint8_t *)(s + 1);
+    s->freeMap = SLAB_FULL_MAP;
+    for (int i = 0; i < SLAB_OBJECTS_PER_SLAB; i++)
+        *(uintptr_t *)(s->objects + i * stride) = (uintptr_t)s;
+
+    target_disable_irq();
+    s->next = slabs;
+    slabs = s;
+    stats.slabs++;
+    target_enable_irq();
+
+    return s;
+}
+
+// Call with IRQs disabled.
+REAL_TIME_FUNC
+SlabPool::Slab *SlabPool::findFree()
+{
+    Slab *s = hint;
+    if (s == NULL || s->freeMap == 0)
+    {
+        // Slabs are few (one per SLAB_OBJECTS_PER_SLAB live objects), so this walk is short.
+        for (s = slabs; s && s->freeMap == 0; s = s->next)
+            ;
+    }
+    return s;
+}
+
+SlabPool::Slab *SlabPool::owner(void *p)
+{
+    uint8_t *b = (uint8_t *)p;
+    for (Slab *s = slabs; s; s = s->next)
+        if (b >= s->objects && b < s->objects + stride * SLAB_OBJECTS_PER_SLAB)
+            return s;
+    return NULL;
+}
+
+REAL_TIME_FUNC
+void *SlabPool::alloc()
+{
+    target_disable_irq();
+
+    // Look up and claim in one critical section, so an ISR can't take the slot in between
+    Slab *s;
+    while ((s = findFree()) == NULL)
+    {
+        // device_malloc() has its own critical section. An ISR may use up the new slab
+        // before we get back, in which case look again and grow again.
+        target_enable_irq();
+        Slab *grown = grow();
+        target_disable_irq();
+        if (grown == NULL)
+        {
+            stats.failures++;
+            target_enable_irq();
+            return NULL;
+        }
+    }
+
+    int slot = __builtin_ctz(s->freeMap);
+    s->freeMap &= ~(1UL << slot);
+    hint = s;
+
+    stats.allocs++;
+    if (++stats.inUse > stats.highWater)
+        stats.highWater = stats.inUse;
+    target_enable_irq();
+
+    return s->objects + slot * stride + SLAB_TAG_BYTES;
+}
+
+REAL_TIME_FUNC
+void SlabPool::release(Slab *s, void *p)
+{
+    int slot = ((uint8_t *)p - SLAB_TAG_BYTES - s->objects) / stride;
+
+    target_disable_irq();
+    s->freeMap |= 1UL << slot;
+    stats.inUse--;
+    hint = s;
+    target_enable_irq();
+}
+
+REAL_TIME_FUNC
+bool SlabPool::free(void *p)
+{
+    uintptr_t tag = tagOf(p);
+    if (tag == SLAB_HEAP_TAG || ((Slab *)tag)->pool != this)
+        return false;
+
+    release((Slab *)tag, p);
+    return true;
+}
+
+REAL_TIME_FUNC
+void *codal::slab_malloc(size_t size)
+{
+    for (int i = 0; i < SLAB_SIZE_CLASSES; i++)
+        if (size <= slabClasses[i].stats.objectSize)
+        {
+            void *p = slabClasses[i].alloc();
+            if (p)
+                return p;
+            break;
+        }
+
+    uint8_t *b = (uint8_t *)device_malloc(SLAB_TAG_BYTES + size);
+    if (b == NULL)
+        return NULL;
+    *(uintptr_t *)b = SLAB_HEAP_TAG;
+    return b + SLAB_TAG_BYTES;
+}
+
+REAL_TIME_FUNC
+void codal::slab_free(void *p)
+{
+    if (p == NULL)
+        return;
+
+    uintptr_t tag = tagOf(p);
+    if (tag == SLAB_HEAP_TAG)
+        device_free((uint8_t *)p - SLAB_TAG_BYTES);
+    else
+        ((SlabPool::Slab *)tag)->pool->release((SlabPool::Slab *)tag, p);
+}
+
+const SlabStats *codal::slab_stats(int i)
+{
+    if (i < 0 || i >= SLAB_SIZE_CLASSES)
+        return NULL;
+    return &slabClasses[i].stats;
+}
+
+void codal::slab_dump()
+{
+    for (int i = 0; i < SLAB_SIZE_CLASSES; i++)
+    {
+        SlabStats &s = slabClasses[i].stats;
+        DMESG("slab %d: %d slabs, %d in use (max %d), %d allocs, %d failed", s.objectSize, s.slabs, s.inUse,
+              s.highWater, s.allocs, s.failures);
+    }
+}
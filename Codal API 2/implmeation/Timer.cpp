@@ -38,6 +38,7 @@ DEALINGS IN THE SOFTWARE.
 #include "Event.h"
 #include "CodalCompat.h"
 #include "ErrorNo.h"
+
 #include "codal_target_hal.h"
 #include "CodalDmesg.h"
 #include "CodalFiber.h"
@@ -72,23 +73,34 @@ void Timer::triggerIn(CODAL_TIMESTAMP t)
     target_enable_irq();
 }
 
+// timerEventFree has one bit per slot of timerEventList
+#if CODAL_TIMER_DEFAULT_EVENT_LIST_SIZE > 32
+#error "timerEventFree holds at most 32 timer event slots"
+#endif
+
 REAL_TIME_FUNC
 TimerEvent *Timer::getTimerEvent()
 {
-    // Find the first unused slot, and assign it.
-    for (int i=0; i < eventListSize; i++)
+    // Take the first unused slot from the free map.
+    target_disable_irq();
+    if (timerEventFree == 0)
     {
-        if (timerEventList[i].id == 0)
-            return &timerEventList[i];
+        // TODO: should try to realloc the list here.
+        target_enable_irq();
+        return NULL;
     }
 
-    // TODO: should try to realloc the list here.
-    return NULL;
+    int i = __builtin_ctz(timerEventFree);
+    timerEventFree &= ~(1UL << i);
+    target_enable_irq();
+
+    return &timerEventList[i];
 }
 
 void Timer::releaseTimerEvent(TimerEvent *event)
 {
     event->id = 0;
+    timerEventFree |= 1UL << (event - timerEventList);
     if (nextTimerEvent == event)
         nextTimerEvent = NULL;
 }
@@ -104,11 +116,13 @@ Timer::Timer(LowLevelTimer& t, uint8_t ccPeriodChannel, uint8_t ccEventChannel)
 
     this->ccPeriodChannel = ccPeriodChannel;
     this->ccEventChannel = ccEventChannel;
+    deepSleeping = false;
 
     // Create an empty event list of the default size.
     eventListSize = CODAL_TIMER_DEFAULT_EVENT_LIST_SIZE;
     timerEventList = (TimerEvent *) malloc(sizeof(TimerEvent) * CODAL_TIMER_DEFAULT_EVENT_LIST_SIZE);
     memclr(timerEventList, sizeof(TimerEvent) * CODAL_TIMER_DEFAULT_EVENT_LIST_SIZE);
+    timerEventFree = 0xFFFFFFFFUL >> (32 - CODAL_TIMER_DEFAULT_EVENT_LIST_SIZE);
     nextTimerEvent = NULL;
 
     // Reset clock
@@ -201,7 +215,7 @@ int Timer::cancel(uint16_t id, uint16_t value)
     target_disable_irq();
     if (nextTimerEvent && nextTimerEvent->id == id && nextTimerEvent->value == value)
     {
-        nextTimerEvent->id = 0;
+        releaseTimerEvent(nextTimerEvent);
         recomputeNextTimerEvent();
         res = DEVICE_OK;
     }
@@ -210,7 +224,7 @@ int Timer::cancel(uint16_t id, uint16_t value)
         {
             if (timerEventList[i].id == id && timerEventList[i].value == value)
             {
-                timerEventList[i].id = 0;
+                releaseTimerEvent(&timerEventList[i]);
                 res = DEVICE_OK;
                 break;
             }
@@ -353,6 +367,13 @@ void Timer::recomputeNextTimerEvent()
  */
 void Timer::trigger(bool isFallback)
 {
+    // A deep sleep wake-up: the power manager keeps time until deepSleepEnd
+    if (deepSleeping)
+    {
+        timer.disableIRQ();
+        return;
+    }
+
     if (isFallback)
         timer.setCompare(ccPeriodChannel, timer.captureCounter() + 10000000);
 
@@ -472,12 +493,47 @@ CODAL_TIMESTAMP Timer::deepSleepBegin( CODAL_TIMESTAMP &counter)
     }
 
     timer.disableIRQ();
+    deepSleeping = true;
     target_enable_irq();
 
     counter = val;
     return currentTimeUs;
 }
 
+REAL_TIME_FUNC
+CODAL_TIMESTAMP Timer::deepSleepWakeIn( CODAL_TIMESTAMP micros)
+{
+#if CONFIG_ENABLED(CODAL_TIMER_32BIT)
+    const CODAL_TIMESTAMP reach = 0xFFFFFFFF;
+#else
+    const CODAL_TIMESTAMP reach = 0xFFFF;
+#endif
+    // Leave a margin below the wrap so the compare can't land behind the counter
+    if (micros > reach - CODAL_TIMER_MINIMUM_PERIOD)
+        micros = reach - CODAL_TIMER_MINIMUM_PERIOD;
+    if (micros < CODAL_TIMER_MINIMUM_PERIOD)
+        micros = CODAL_TIMER_MINIMUM_PERIOD;
+
+    target_disable_irq();
+    timer.setCompare(ccEventChannel, timer.captureCounter() + micros);
+    timer.enableIRQ();
+    target_enable_irq();
+    return micros;
+}
+
+REAL_TIME_FUNC
+CODAL_TIMESTAMP Timer::deepSleepElapsed( CODAL_TIMESTAMP &counter)
+{
+    uint32_t val = timer.captureCounter();
+#if CONFIG_ENABLED(CODAL_TIMER_32BIT)
+    CODAL_TIMESTAMP elapsed = (uint32_t)(val - (uint32_t)counter);
+#else
+    CODAL_TIMESTAMP elapsed = (uint16_t)(val - (uint16_t)counter);
+#endif
+    counter = val;
+    return elapsed;
+}
+
 /**
   * After taking over time tracking with system_timer_deepsleep_begin,
   * hand back control by supplying a new timer counter value with
@@ -499,8 +555,10 @@ CODAL_TIMESTAMP Timer::deepSleepBegin( CODAL_TIMESTAMP &counter)
 REAL_TIME_FUNC
 void Timer::deepSleepEnd( CODAL_TIMESTAMP counter, CODAL_TIMESTAMP micros)
 {
-    // On entry, the timer IRQ is disabled and must not be enabled
+    // The timer IRQ may still be armed by deepSleepWakeIn; keep it off until events are rescheduled
     target_disable_irq();
+    timer.disableIRQ();
+    deepSleeping = false;
 
     if ( micros > 0)
     {
@@ -560,6 +618,8 @@ void Timer::deepSleepEnd( CODAL_TIMESTAMP counter, CODAL_TIMESTAMP micros)
     if (nextTimerEvent)
         timer.setCompare( ccEventChannel, counterNow + CODAL_TIMER_MINIMUM_PERIOD);
 
+    // Turned off by deepSleepBegin
+    timer.enableIRQ();
     target_enable_irq();
 }
 
@@ -579,6 +639,17 @@ bool Timer::deepSleepWakeUpTime( CODAL_TIMESTAMP &timestamp)
     return true;
 }
 
+/**
+ * Called from power manager after the core clock changed.
+ */
+void Timer::clockChanged()
+{
+    target_disable_irq();
+    sync();
+    timer.setClockSpeed(1000);
+    target_enable_irq();
+}
+
 /**
  * Destructor for this Timer instance
  */
@@ -840,3 +911,41 @@ bool codal::system_timer_deepsleep_wakeup_time( CODAL_TIMESTAMP &timestamp)
     return system_timer->deepSleepWakeUpTime(timestamp);
 }
 
+/**
+ * While in deep sleep, arm the timer to interrupt the core `micros` from now.
+ * @return the microseconds actually armed, at most one counter wrap; 0 if no timer has been registered.
+ */
+CODAL_TIMESTAMP codal::system_timer_deepsleep_wake_in( CODAL_TIMESTAMP micros)
+{
+    if(system_timer == NULL)
+        return 0;
+
+    return system_timer->deepSleepWakeIn(micros);
+}
+
+/**
+ * While in deep sleep, measure the time passed since the counter was last read.
+ * @param counter the counter last read, updated to the current one
+ * @return microseconds elapsed
+ */
+CODAL_TIMESTAMP codal::system_timer_deepsleep_elapsed( CODAL_TIMESTAMP &counter)
+{
+    if(system_timer == NULL)
+        return 0;
+
+    return system_timer->deepSleepElapsed(counter);
+}
+
+/**
+ * Rescale the system timer and cycle counting after the core clock frequency changed.
+ *
+ * @return DEVICE_OK or DEVICE_NOT_SUPPORTED if no timer has been registered.
+ */
+int codal::system_timer_clock_changed()
+{
+    if(system_timer == NULL)
+        return DEVICE_NOT_SUPPORTED;
+
+    system_timer->clockChanged();
+    return system_timer_calibrate_cycles();
+}
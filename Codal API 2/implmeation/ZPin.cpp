@@ -42,6 +42,7 @@ DEALINGS IN THE SOFTWARE.
 
 #define PORTPINS 16
 #define PINMASK (PORTPINS - 1)
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
 
 #define GPIO_PORT() ((GPIO_TypeDef *)(GPIOA_BASE + 0x400 * ((int)name >> 4)))
 #define GPIO_PIN() (1 << ((uint32_t)name & 0xf))
@@ -50,6 +51,7 @@ namespace codal
 {
 
 static ZPin *eventPin[16];
+static ZPin *pwmPin[8];
 static ADC_HandleTypeDef AdcHandle;
 static bool adcInited = false;
 
@@ -107,6 +109,9 @@ void ZPin::disconnect()
         if (this->pwmCfg)
             delete this->pwmCfg;
         this->pwmCfg = NULL;
+        for (unsigned i = 0; i < ARRAY_SIZE(pwmPin); ++i)
+            if (pwmPin[i] == this)
+                pwmPin[i] = NULL;
     }
 
     if (this->status & (IO_STATUS_EVENT_ON_EDGE | IO_STATUS_EVENT_PULSE_ON_EDGE | IO_STATUS_INTERRUPT_ON_EDGE))
@@ -250,11 +255,33 @@ int ZPin::obtainAnalogChannel()
         auto cfg = this->pwmCfg = new pwmout_t;
         pwmout_init(cfg, name);
         status = IO_STATUS_ANALOG_OUT;
+
+        for (unsigned i = 0; i < ARRAY_SIZE(pwmPin); ++i)
+        {
+            if (pwmPin[i] == NULL)
+            {
+                pwmPin[i] = this;
+                break;
+            }
+        }
     }
 
     return DEVICE_OK;
 }
 
+void ZPin::clockChanged()
+{
+    for (unsigned i = 0; i < ARRAY_SIZE(pwmPin); ++i)
+    {
+        if (!pwmPin[i])
+            continue;
+        auto cfg = pwmPin[i]->pwmCfg;
+        uint32_t pulse = cfg->pulse;
+        pwmout_period_us(cfg, cfg->period);
+        pwmout_write(cfg, pulse);
+    }
+}
+
 int ZPin::setPWM(uint32_t value, uint32_t period)
 {
     // sanitise the level value
@@ -310,6 +310,13 @@ ZSPI::ZSPI(Pin &mosi, Pin &miso, Pin &sclk, Pin *cs) : codal::SPI()
     }
 }
 
+void ZSPI::clockChanged()
+{
+    for (unsigned i = 0; i < ARRAY_SIZE(instances); ++i)
+        if (instances[i])
+            instances[i]->needsInit = true;
+}
+
 int ZSPI::setFrequency(uint32_t frequency)
 {
     freq = frequency;
@@ -28,10 +28,10 @@ int main() {
     PIL::Mount();
     std::cout << "Filesystem mounted." << std::endl;
 
-    // Register a simple task (demo)
-    PIL::RegisterTask([](){
-        std::cout << "Hello from a registered task!" << std::endl;
-    }, true);
+    // Launch a simple app (demo); its allocations come from its own arena
+    int demoApp = PIL::LaunchApp("demo", [](){
+        std::cout << "Hello from a launched app!" << std::endl;
+    });
 
     // Main OS loop (simple demo)
     while (true) {
@@ -40,6 +40,9 @@ int main() {
         break; // Remove this break for a real OS loop
     }
 
+    if (demoApp >= 0) {
+        PIL::ExitApp(demoApp);
+    }
     std::cout << "ARCADEOS shutdown." << std::endl;
     return 0;
-}
\ No newline at end of file
+}
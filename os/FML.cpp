@@ -2,6 +2,7 @@
 #include <iostream>
 #include <unordered_map>
 #include "pxt.h"
+#include "CodalSlabAllocator.h"
 #include "settings.cpp"
 
 namespace FML
@@ -45,7 +46,11 @@ namespace FML
         }
 
         // Copy file contents into RAM
-        char *ramBuffer = new char[buffer->length]; // Allocate RAM buffer
+        char *ramBuffer = (char *)codal::slab_malloc(buffer->length); // Small files come from the slab pools
+        if (!ramBuffer)
+        {
+            return false;
+        }
         memcpy(ramBuffer, buffer->data, buffer->length);
 
         // Add file to cache registry
@@ -70,7 +75,7 @@ namespace FML
         auto it = cachedFiles.find(fileName);
         if (it != cachedFiles.end())
         {
-            delete[] it->second; // Free allocated RAM buffer
+            codal::slab_free(it->second); // Free allocated RAM buffer
             cachedFiles.erase(it);
         }
     }
@@ -80,7 +85,7 @@ namespace FML
     {
         for (auto &entry : cachedFiles)
         {
-            delete[] entry.second; // Free all RAM buffers
+            codal::slab_free(entry.second); // Free all RAM buffers
         }
         cachedFiles.clear();
     }
@@ -251,7 +256,13 @@ namespace FML
         }
 
         // Allocate RAM and copy file contents
-        uint8_t *ramBuffer = new uint8_t[buffer->length];
+        uint8_t *ramBuffer = (uint8_t *)codal::slab_malloc(buffer->length);
+        if (!ramBuffer)
+        {
+            // Slab pools exhausted: hand back the Flash copy without caching it
+            std::cout << "FML: Cache file '" << fileName << "' not cached, out of RAM.\n";
+            return buffer;
+        }
         memcpy(ramBuffer, buffer->data, buffer->length);
         ramCache[fileName] = {ramBuffer, buffer->length};
 
@@ -446,4 +457,4 @@ namespace FML
     {
         return Kernel::DeallocateRAM(pointer);
     }
-}
\ No newline at end of file
+}
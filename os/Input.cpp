@@ -1,7 +1,335 @@
 #include "Input.h"
 #include "pins.h"
 #include "configkeys.h"
+#include "OSconfig.h"
+#include "Button.h"
+#include "EventModel.h"
+#include "Timer.h"
+#include "stm32f4xx.h"
+#include "pxt.h"
+#include "kernel/Kernel.h"
+#include "CodalDmesg.h"
 #include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#define GPIO_PORT_OF(name) ((GPIO_TypeDef *)(GPIOA_BASE + 0x400 * ((int)(name) >> 4)))
+#define GPIO_MASK_OF(name) (1UL << ((int)(name) & 0xF))
+
+// Pin config key of each BTN_* ID
+static const int buttonKeys[BTN_COUNT + 1] = {
+    0, PIN_BTN_A, PIN_BTN_B, PIN_BTN_UP, PIN_BTN_DOWN, PIN_BTN_LEFT, PIN_BTN_RIGHT, PIN_BTN_MENU, PIN_BTN_SOFT_RESET};
+
+// Debounced input: one CODAL button per BTN_* ID, driven by the system tick
+static codal::Button *buttons[BTN_COUNT + 1];
+static bool inputStarted = false;
+static volatile uint16_t heldMask = 0; // Bit per BTN_* ID, debounced
+
+// Single producer (button events) / single consumer (game loop) ring
+static InputEvent inputQueue[INPUT_QUEUE_SIZE];
+static volatile uint8_t queueHead = 0; // Written by the producer only
+static volatile uint8_t queueTail = 0; // Written by the consumer only
+static volatile uint32_t droppedEvents = 0;
+
+namespace settings
+{
+    int _set(String key, Buffer data);
+    Buffer _get(String key);
+}
+
+// Record / replay state
+struct InputLogHeader
+{
+    uint32_t magic;
+    uint32_t count;
+    uint32_t frames; // Length of the recording; the replay runs until this frame
+};
+
+static InputRecord *inputLog = nullptr; // Allocated while recording or replaying
+static uint32_t inputLogCount = 0;
+static uint32_t replayNext = 0;
+static uint32_t replayFrames = 0;
+static bool recording = false;
+static bool replaying = false;
+static VirtualButton *replayButtons[BTN_COUNT + 1];
+
+static uint32_t frameNumber = 0;
+static uint64_t runStartUs = 0, lastFrameUs = 0;
+static InputRunStats runStats;
+
+// Input-to-photon trace: one press followed through the pipeline at a time
+struct LatencyTrace
+{
+    uint32_t edgeUs, dequeueUs, renderUs, transferUs;
+    uint8_t stage; // 0 idle, 1 dequeued, 2 rendered, 3 transferred
+};
+
+static LatencyTrace trace;
+static InputLatencyHistogram latency[INPUT_LATENCY_STAGES];
+
+static void addLatency(uint8_t stage, uint32_t us)
+{
+    InputLatencyHistogram &h = latency[stage];
+    uint32_t ms = us / 1000;
+    uint32_t b = ms ? 32 - __builtin_clz(ms) : 0;
+    h.bucket[b < INPUT_LATENCY_BUCKETS ? b : INPUT_LATENCY_BUCKETS - 1]++;
+    h.count++;
+    h.totalUs += us;
+    if (us > h.maxUs)
+    {
+        h.maxUs = us;
+    }
+}
+
+// The previous frame has been drawn and sent; close the trace
+static void finishTrace()
+{
+    addLatency(INPUT_LATENCY_DISPATCH, trace.dequeueUs - trace.edgeUs);
+    addLatency(INPUT_LATENCY_RENDER, trace.renderUs - trace.dequeueUs);
+    addLatency(INPUT_LATENCY_TRANSFER, trace.transferUs - trace.renderUs);
+    addLatency(INPUT_LATENCY_TOTAL, trace.transferUs - trace.edgeUs);
+    trace.stage = 0;
+}
+
+static void queueInputEvent(const InputEvent &event)
+{
+    uint8_t head = queueHead;
+    if ((uint8_t)(head - queueTail) >= INPUT_QUEUE_SIZE)
+    {
+        droppedEvents++;
+        return;
+    }
+
+    inputQueue[head & (INPUT_QUEUE_SIZE - 1)] = event;
+    __sync_synchronize(); // Publish the event before the new head
+    queueHead = head + 1;
+}
+
+static void pushInputEvent(uint8_t button, uint8_t type)
+{
+    if (replaying)
+    {
+        return; // The replay owns the input until it ends
+    }
+
+    InputEvent event;
+    event.timeUs = (uint32_t)codal::system_timer_current_time_us();
+    event.button = button;
+    event.type = type;
+    queueInputEvent(event);
+
+    if (recording && inputLogCount < INPUT_RECORD_MAX)
+    {
+        InputRecord &r = inputLog[inputLogCount++];
+        r.frame = frameNumber;
+        r.event = event;
+        r.event.timeUs -= (uint32_t)runStartUs;
+    }
+}
+
+static void onButtonEvent(codal::Event evt)
+{
+    uint8_t id = evt.source - DEVICE_ID_OS_INPUT;
+    switch (evt.value)
+    {
+    case DEVICE_BUTTON_EVT_DOWN:
+        heldMask |= 1 << id;
+        pushInputEvent(id, INPUT_EVT_PRESS);
+        break;
+    case DEVICE_BUTTON_EVT_UP:
+        heldMask &= ~(1 << id);
+        pushInputEvent(id, INPUT_EVT_RELEASE);
+        break;
+    case DEVICE_BUTTON_EVT_HOLD:
+        pushInputEvent(id, INPUT_EVT_HOLD);
+        break;
+    }
+}
+
+bool StartInputEvents()
+{
+    if (inputStarted)
+    {
+        return true;
+    }
+    if (!codal::EventModel::defaultEventBus)
+    {
+        return false;
+    }
+
+    for (uint8_t id = BTN_A; id <= BTN_SOFT_RESET; ++id)
+    {
+        DigitalInOutPin pin = pins::pinByCfg(buttonKeys[id]);
+        if (!pin)
+        {
+            continue; // Not fitted on this board
+        }
+        buttons[id] = new codal::Button(*pin, DEVICE_ID_OS_INPUT + id, DEVICE_BUTTON_SIMPLE_EVENTS, ACTIVE_HIGH, codal::PullMode::Down);
+        codal::EventModel::defaultEventBus->listen(DEVICE_ID_OS_INPUT + id, DEVICE_EVT_ANY, onButtonEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
+    }
+    inputStarted = true;
+    return true;
+}
+
+uint8_t DrainInputEvents(InputEvent *out, uint8_t max)
+{
+    uint8_t tail = queueTail;
+    uint8_t count = 0;
+    while (count < max && tail != queueHead)
+    {
+        __sync_synchronize(); // Read the event only after seeing the head that published it
+        out[count++] = inputQueue[tail & (INPUT_QUEUE_SIZE - 1)];
+        tail++;
+    }
+    queueTail = tail;
+
+    // Start tracing the first press the app sees, unless one is still in flight
+    for (uint8_t i = 0; i < count && trace.stage == 0; i++)
+    {
+        if (out[i].type == INPUT_EVT_PRESS)
+        {
+            trace.edgeUs = out[i].timeUs;
+            trace.dequeueUs = (uint32_t)codal::system_timer_current_time_us();
+            trace.stage = 1;
+        }
+    }
+    return count;
+}
+
+uint32_t DroppedInputEvents()
+{
+    return droppedEvents;
+}
+
+// Port snapshot: buttons grouped by GPIO port so each input register is read once
+struct InputPort
+{
+    GPIO_TypeDef *gpio;
+    uint8_t count;                // Buttons on this port
+    uint16_t pinMask[BTN_COUNT];  // IDR bit of each of them
+    uint16_t buttonBit[BTN_COUNT]; // And the matching 1 << BTN_* bit
+};
+
+static InputPort inputPorts[BTN_COUNT];
+static uint8_t inputPortCount = 0;
+static bool inputPortsBuilt = false;
+static uint16_t lastSnapshot = 0;
+
+void BuildInputPortMap()
+{
+    inputPortCount = 0;
+    for (uint8_t id = BTN_A; id <= BTN_SOFT_RESET; ++id)
+    {
+        DigitalInOutPin pin = pins::pinByCfg(buttonKeys[id]);
+        if (!pin)
+        {
+            continue;
+        }
+        pin->getDigitalValue(codal::PullMode::Down); // Leaves the pin configured as an input
+
+        GPIO_TypeDef *gpio = GPIO_PORT_OF(pin->name);
+        uint8_t p = 0;
+        while (p < inputPortCount && inputPorts[p].gpio != gpio)
+        {
+            p++;
+        }
+        if (p == inputPortCount)
+        {
+            inputPorts[p] = InputPort();
+            inputPorts[p].gpio = gpio;
+            inputPortCount++;
+        }
+        InputPort &port = inputPorts[p];
+        port.pinMask[port.count] = GPIO_MASK_OF(pin->name);
+        port.buttonBit[port.count] = 1 << id;
+        port.count++;
+    }
+    inputPortsBuilt = true;
+}
+
+uint16_t ReadInputPorts()
+{
+    if (!inputPortsBuilt)
+    {
+        BuildInputPortMap();
+    }
+
+    uint16_t held = 0;
+    for (uint8_t p = 0; p < inputPortCount; p++)
+    {
+        const InputPort &port = inputPorts[p];
+        uint32_t idr = port.gpio->IDR;
+        for (uint8_t i = 0; i < port.count; i++)
+        {
+            if (idr & port.pinMask[i])
+            {
+                held |= port.buttonBit[i];
+            }
+        }
+    }
+    return held;
+}
+
+// Buttons with a wake-up edge interrupt, bit per BTN_* ID
+static uint16_t wakeArmed = 0;
+
+bool ArmButtonWake(bool armed)
+{
+    bool all = true;
+    for (uint8_t id = BTN_A; id <= BTN_SOFT_RESET; ++id)
+    {
+        DigitalInOutPin pin = pins::pinByCfg(buttonKeys[id]);
+        if (!pin)
+        {
+            continue;
+        }
+        if (!armed)
+        {
+            if (wakeArmed & (1 << id))
+            {
+                pin->eventOn(DEVICE_PIN_EVENT_NONE); // Back to a plain pulled-down input
+            }
+            continue;
+        }
+        if (EXTI->IMR & GPIO_MASK_OF(pin->name))
+        {
+            all = false;
+            continue;
+        }
+        pin->eventOn(DEVICE_PIN_INTERRUPT_ON_EDGE); // No handler: the interrupt only ends the halt
+        wakeArmed |= 1 << id;
+    }
+    if (!armed)
+    {
+        wakeArmed = 0;
+    }
+    return all;
+}
+
+InputSnapshot SampleInput()
+{
+    InputSnapshot snapshot;
+    snapshot.held = 0;
+    if (replaying)
+    {
+        // The recording is the input now; the live pins only matter to PM's sleep check
+        for (uint8_t id = BTN_A; id <= BTN_SOFT_RESET; ++id)
+        {
+            if (replayButtons[id]->isPressed())
+            {
+                snapshot.held |= 1 << id;
+            }
+        }
+    }
+    else
+    {
+        snapshot.held = ReadInputPorts();
+    }
+    snapshot.pressed = snapshot.held & ~lastSnapshot;
+    snapshot.released = lastSnapshot & ~snapshot.held;
+    lastSnapshot = snapshot.held;
+    return snapshot;
+}
 
 // Helper: Check if a pin is HIGH
 static bool isHigh(int key)
@@ -16,17 +344,255 @@ bool Button::isPressed() const
     return isHigh(Hardware_ID);
 }
 
+static void resetRun()
+{
+    frameNumber = 0;
+    runStartUs = lastFrameUs = codal::system_timer_current_time_us();
+    memset(&runStats, 0, sizeof(runStats));
+}
+
+static void freeInputLog()
+{
+    if (inputLog)
+    {
+        Kernel::DeallocateRAM((uint32_t *)inputLog);
+        inputLog = nullptr;
+    }
+    inputLogCount = 0;
+}
+
+// Apply the replayed events recorded up to the current frame
+static void applyReplay()
+{
+    uint32_t shift = (uint32_t)runStartUs;
+    while (replayNext < inputLogCount && inputLog[replayNext].frame <= frameNumber)
+    {
+        InputEvent event = inputLog[replayNext++].event;
+        VirtualButton *button = event.button <= BTN_COUNT ? replayButtons[event.button] : nullptr;
+        if (button && event.type == INPUT_EVT_PRESS)
+        {
+            button->press();
+        }
+        else if (button && event.type == INPUT_EVT_RELEASE)
+        {
+            button->release();
+        }
+        event.timeUs += shift;
+        queueInputEvent(event);
+    }
+    if (replayNext >= inputLogCount && frameNumber >= replayFrames)
+    {
+        StopInputReplay();
+    }
+}
+
+void AdvanceInputFrame()
+{
+    uint64_t now = codal::system_timer_current_time_us();
+
+    if (trace.stage == 3)
+    {
+        finishTrace(); // Last frame is on the panel
+    }
+    else if (trace.stage == 2)
+    {
+        trace.stage = 0; // Last frame went out without a DMA transfer, no display timing to report
+    }
+    if (trace.stage == 1)
+    {
+        trace.renderUs = (uint32_t)now;
+        trace.stage = 2;
+    }
+    uint32_t frameUs = (uint32_t)(now - lastFrameUs);
+    lastFrameUs = now;
+    frameNumber++;
+
+    runStats.frames++;
+    runStats.totalUs += frameUs;
+    if (frameUs > runStats.worstFrameUs)
+    {
+        runStats.worstFrameUs = frameUs;
+    }
+
+    if (replaying)
+    {
+        applyReplay();
+    }
+}
+
+bool StartInputRecording()
+{
+    if (replaying || recording)
+    {
+        return false;
+    }
+    freeInputLog();
+    // The log belongs to the OS, not to whichever app is running when recording starts
+    inputLog = (InputRecord *)Kernel::AllocateSystemRAM(sizeof(InputRecord) * INPUT_RECORD_MAX);
+    if (!inputLog)
+    {
+        return false;
+    }
+    StartInputEvents();
+    resetRun();
+    recording = true;
+    return true;
+}
+
+bool StopInputRecording(const char *key)
+{
+    if (!recording)
+    {
+        return false;
+    }
+    recording = false;
+
+    InputLogHeader header = {INPUT_RECORD_MAGIC, inputLogCount, frameNumber};
+    uint32_t bytes = sizeof(header) + sizeof(InputRecord) * inputLogCount;
+    Buffer data = mkBuffer(NULL, bytes);
+    memcpy(data->data, &header, sizeof(header));
+    memcpy(data->data + sizeof(header), inputLog, sizeof(InputRecord) * inputLogCount);
+    int result = settings::_set(mkString(key, -1), data);
+
+    std::cout << "Input: Recorded " << inputLogCount << " events over " << runStats.frames << " frames\n";
+    freeInputLog();
+    return result == 0;
+}
+
+bool StartInputReplay(const char *key)
+{
+    if (replaying || recording)
+    {
+        return false;
+    }
+
+    Buffer data = settings::_get(mkString(key, -1));
+    InputLogHeader header;
+    if (!data || data->length < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data->data, sizeof(header));
+    if (header.magic != INPUT_RECORD_MAGIC || header.count > INPUT_RECORD_MAX ||
+        data->length < sizeof(header) + sizeof(InputRecord) * header.count)
+    {
+        std::cerr << "Input: '" << key << "' is not an input recording\n";
+        return false;
+    }
+
+    freeInputLog();
+    inputLog = (InputRecord *)Kernel::AllocateSystemRAM(sizeof(InputRecord) * (header.count ? header.count : 1));
+    if (!inputLog)
+    {
+        return false;
+    }
+    memcpy(inputLog, data->data + sizeof(header), sizeof(InputRecord) * header.count);
+    inputLogCount = header.count;
+    replayNext = 0;
+    replayFrames = header.frames;
+
+    for (uint8_t id = BTN_A; id <= BTN_SOFT_RESET; ++id)
+    {
+        replayButtons[id] = new VirtualButton(id);
+    }
+    queueTail = queueHead; // Drop pending live events so every run starts from the same state
+    lastSnapshot = 0;      // The replayed buttons start released
+    resetRun();
+    replaying = true;
+    applyReplay(); // Events recorded before the first frame
+    return true;
+}
+
+void StopInputReplay()
+{
+    if (!replaying)
+    {
+        return;
+    }
+    replaying = false;
+    for (uint8_t id = BTN_A; id <= BTN_SOFT_RESET; ++id)
+    {
+        delete replayButtons[id];
+        replayButtons[id] = nullptr;
+    }
+    freeInputLog();
+
+    uint32_t average = runStats.frames ? runStats.totalUs / runStats.frames : 0;
+    std::cout << "Input: Replay done, " << runStats.frames << " frames, average " << average << " us, worst "
+              << runStats.worstFrameUs << " us\n";
+}
+
+bool IsReplayingInput()
+{
+    return replaying;
+}
+
+const InputRunStats &GetInputRunStats()
+{
+    return runStats;
+}
+
+void MarkDisplayTransferDone()
+{
+    if (trace.stage >= 2)
+    {
+        trace.transferUs = (uint32_t)codal::system_timer_current_time_us();
+        trace.stage = 3;
+    }
+}
+
+const InputLatencyHistogram *GetInputLatency(uint8_t stage)
+{
+    return stage < INPUT_LATENCY_STAGES ? &latency[stage] : nullptr;
+}
+
+void DumpInputLatency()
+{
+    static const char *const names[INPUT_LATENCY_STAGES] = {"dispatch", "render", "transfer", "total"};
+
+    DMESG("input latency: debounce ~%d us (sigma filter)", DEVICE_BUTTON_SIGMA_THRESH_HI * SCHEDULER_TICK_PERIOD_US);
+    for (uint8_t s = 0; s < INPUT_LATENCY_STAGES; s++)
+    {
+        const InputLatencyHistogram &h = latency[s];
+        DMESG("%s: n=%d avg=%d us max=%d us", names[s], h.count, h.count ? (int)(h.totalUs / h.count) : 0, h.maxUs);
+        DMESG("  <1:%d <2:%d <4:%d <8:%d <16:%d <32:%d <64:%d <128:%d <256:%d more:%d", h.bucket[0], h.bucket[1],
+              h.bucket[2], h.bucket[3], h.bucket[4], h.bucket[5], h.bucket[6], h.bucket[7], h.bucket[8], h.bucket[9]);
+    }
+}
+
+void ResetInputLatency()
+{
+    memset(latency, 0, sizeof(latency));
+    trace.stage = 0;
+}
+
 // Implementation of isPressed for button ID
 bool isPressed(uint8_t id)
 {
+    if (replaying && id >= BTN_A && id <= BTN_SOFT_RESET)
+    {
+        return replayButtons[id]->isPressed();
+    }
+    if (id >= BTN_A && id <= BTN_SOFT_RESET && StartInputEvents())
+    {
+        return heldMask & (1 << id);
+    }
     return Button(id).isPressed();
 }
 
-// Wait until a button is pressed
+// Wait until a button is pressed, sleeping the fiber between button events
 bool waitUntilBTNPressed(uint8_t id)
 {
     while (!isPressed(id))
     {
+        if (replaying)
+        {
+            codal::schedule(); // Replayed presses arrive with the frames
+        }
+        else if (inputStarted && id >= BTN_A && id <= BTN_SOFT_RESET)
+        {
+            codal::fiber_wait_for_event(DEVICE_ID_OS_INPUT + id, DEVICE_BUTTON_EVT_DOWN);
+        }
     }
     return true;
 }
@@ -34,6 +600,20 @@ bool waitUntilBTNPressed(uint8_t id)
 // Return the first button found pressed, or BTN_NULL_ID if none
 uint8_t WhatButtonPressed()
 {
+    if (replaying)
+    {
+        for (uint8_t id = BTN_A; id <= BTN_SOFT_RESET; ++id)
+        {
+            if (replayButtons[id]->isPressed())
+                return id;
+        }
+        return BTN_NULL_ID;
+    }
+    if (StartInputEvents())
+    {
+        uint16_t held = heldMask;
+        return held ? __builtin_ctz(held) : BTN_NULL_ID;
+    }
     for (uint8_t id = BTN_A; id <= BTN_SOFT_RESET; ++id)
     {
         if (isPressed(id))
@@ -57,4 +637,4 @@ VirtualButton* MakeVirtual(Button* button)
         temporary->press();
     }
     return temporary;
-}
\ No newline at end of file
+}
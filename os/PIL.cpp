@@ -103,6 +103,8 @@ namespace PIL
             return fileName;
         }
 
+        SLAB_ALLOCATED
+
     private:
         bool endsWith(const char *str, const char *suffix)
         {
@@ -121,6 +123,21 @@ namespace PIL
     {
         Kernel::RegisterTask(taskFunction, visible);
     }
+    int LaunchApp(const std::string &name, std::function<void()> entry, uint32_t arenaBytes)
+    {
+        uint32_t appID = makeNewAppId(name);
+        if (!Kernel::LaunchApp(appID, entry, arenaBytes))
+        {
+            return -1;
+        }
+        return appID;
+    }
+
+    void ExitApp(uint32_t appID)
+    {
+        Kernel::ExitApp(appID);
+    }
+
     /** 
      * Run All Tasks
     */
@@ -299,4 +316,4 @@ namespace PIL
     {
         FML::clearAllCache();
     }
-}
\ No newline at end of file
+}
@@ -1,29 +1,367 @@
 #include "PM.h"
+#include "Input.h"
+#include "OSconfig.h"
 #include "frame.h" // part of the screen API
-#include <thread>
-#include <chrono>
+#include "CodalFiber.h"
+#include "Timer.h"
+#include "codal_target_hal.h"
+#include "EventModel.h"
+#include "ZSPI.h"
+#include "ZPin.h"
+#include "stm32f4xx_ll_rcc.h"
+#include "system_stm32f4xx.h"
+#include <iostream>
+
+#define PM_FLASH_HZ_PER_WS 30000000 // Flash wait state step at 2.7 - 3.6 V
 
 namespace PM
 {
+    // What the sleep loop needs from the platform, so the same loop runs on target and in simulation
+    struct SleepHooks
+    {
+        uint64_t (*now)();                  // Current time in microseconds
+        void (*halt)(uint64_t deadline);    // Halt the core until an interrupt or the deadline
+        bool (*nextWakeUp)(uint64_t &time); // Earliest timer event that must wake us
+        uint16_t (*buttons)();              // One bit per pressed button
+    };
+
+    static SleepReport lastSleep = {};
+
+    static SleepReport sleepLoop(const SleepHooks &hooks, uint64_t durationUs)
+    {
+        SleepReport report = {};
+        report.requestedUs = durationUs;
+
+        uint64_t start = hooks.now();
+        uint64_t deadline = start + durationUs;
+        uint16_t held = hooks.buttons();
+        uint64_t cause = deadline;
+
+        while (true)
+        {
+            uint64_t now = hooks.now();
+            uint64_t wakeAt;
+            if (hooks.buttons() != held)
+            {
+                report.reason = PM_WAKE_BUTTON;
+                cause = now;
+                break;
+            }
+            if (hooks.nextWakeUp(wakeAt) && wakeAt <= now)
+            {
+                report.reason = PM_WAKE_TIMER;
+                cause = wakeAt;
+                break;
+            }
+            if (now >= deadline)
+            {
+                report.reason = PM_WAKE_TIMEOUT;
+                break;
+            }
+
+            uint64_t halted = hooks.now();
+            hooks.halt(deadline);
+            report.sleptUs += hooks.now() - halted;
+            report.wakeups++;
+        }
+
+        uint64_t end = hooks.now();
+        report.elapsedUs = end - start;
+        report.wakeLatencyUs = end > cause ? (uint32_t)(end - cause) : 0;
+        return report;
+    }
+
+    // Target hooks: the system timer's clock stands still between deepsleep_begin and _end, so the
+    // sleep keeps its own from the raw counter. Every halt ends within one counter wrap, which keeps
+    // the readings unambiguous with a 16 bit counter too.
+    static uint64_t sleepClock;
+    static CODAL_TIMESTAMP sleepCounter;
+    static bool buttonsPolled; // Some button has no edge interrupt, so halts are capped
+
+    static uint64_t targetNow()
+    {
+        sleepClock += codal::system_timer_deepsleep_elapsed(sleepCounter);
+        return sleepClock;
+    }
+
+    static bool targetNextWakeUp(uint64_t &time)
+    {
+        CODAL_TIMESTAMP timestamp;
+        if (!codal::system_timer_deepsleep_wakeup_time(timestamp))
+        {
+            return false;
+        }
+        time = timestamp;
+        return true;
+    }
+
+    static void targetHalt(uint64_t deadline)
+    {
+        uint64_t wakeAt = deadline, next;
+        if (targetNextWakeUp(next) && next < wakeAt)
+        {
+            wakeAt = next;
+        }
+        uint64_t now = targetNow();
+        if (wakeAt <= now)
+        {
+            return;
+        }
+
+        // The timer compare wakes us by then at the latest; the button edge interrupts may do it sooner
+        uint64_t wait = wakeAt - now;
+        if (buttonsPolled && wait > PM_BUTTON_POLL_US)
+        {
+            wait = PM_BUTTON_POLL_US;
+        }
+        codal::system_timer_deepsleep_wake_in(wait > 0xFFFFFFFF ? 0xFFFFFFFF : (CODAL_TIMESTAMP)wait);
+        target_deepsleep();
+    }
+
+    // Debounced state stops with the system tick, so read the ports directly
+    static uint16_t targetButtons()
+    {
+        return ReadInputPorts();
+    }
+
+    const SleepReport &SleepFor(uint64_t durationUs)
+    {
+        static const SleepHooks hooks = {targetNow, targetHalt, targetNextWakeUp, targetButtons};
+
+        screen::enter_sleep(); // Freeze the display to save power
+
+        // Stop the scheduler tick; timer events due during sleep fire once on wake
+        codal::fiber_scheduler_set_deepsleep_pending(1);
+        uint64_t start = codal::system_timer_deepsleep_begin(sleepCounter);
+        sleepClock = start;
+        buttonsPolled = !ArmButtonWake(true);
+
+        lastSleep = sleepLoop(hooks, durationUs);
+        ArmButtonWake(false);
+
+        // Hand the time measured while asleep back to the system timer
+        targetNow();
+        codal::system_timer_deepsleep_end(sleepCounter, sleepClock - start);
+        codal::fiber_scheduler_set_deepsleep_pending(0);
+
+        screen::wake();
+        return lastSleep;
+    }
+
+    const SleepReport &LastSleep()
+    {
+        return lastSleep;
+    }
+
+    void EnterSleepState(uint32_t durationInMinutes)
+    {
+        const SleepReport &report = SleepFor((uint64_t)durationInMinutes * 60 * 1000000);
+        std::cout << "PM: Slept " << report.elapsedUs / 1000 << " ms, " << report.wakeups << " wake-ups, reason " << (int)report.reason << "\n";
+    }
+
+    // Simulation hooks: a virtual clock advanced by halt()
+    namespace sim
+    {
+        static uint64_t clock, buttonAt, interruptPeriod;
+        static bool edgeWake;
+
+        static uint64_t now() { return clock; }
+
+        static void halt(uint64_t deadline)
+        {
+            uint64_t next = deadline;
+            if (interruptPeriod)
+            {
+                uint64_t tick = (clock / interruptPeriod + 1) * interruptPeriod;
+                next = tick < next ? tick : next;
+            }
+            if (edgeWake && buttonAt > clock && buttonAt < next)
+            {
+                next = buttonAt;
+            }
+            clock = next;
+        }
+
+        static bool nextWakeUp(uint64_t &) { return false; }
+
+        // Every pin check runs awake, so it is where the wake-up cost is charged
+        static uint16_t buttons()
+        {
+            clock += PM_SIM_WAKE_COST_US;
+            return buttonAt && clock >= buttonAt ? 1 << BTN_A : 0;
+        }
+    }
+
+    SleepReport SimulateSleep(uint64_t durationUs, uint64_t buttonAtUs, uint64_t interruptPeriodUs, bool edgeWake)
+    {
+        static const SleepHooks hooks = {sim::now, sim::halt, sim::nextWakeUp, sim::buttons};
+
+        sim::clock = 0;
+        sim::buttonAt = buttonAtUs;
+        sim::interruptPeriod = interruptPeriodUs;
+        sim::edgeWake = edgeWake;
+
+        SleepReport report = sleepLoop(hooks, durationUs);
+        if (report.reason == PM_WAKE_BUTTON)
+        {
+            report.wakeLatencyUs = (uint32_t)(report.elapsedUs - buttonAtUs); // Measured from the edge itself
+        }
+
+        uint32_t residency = report.elapsedUs ? (uint32_t)(report.sleptUs * 1000 / report.elapsedUs) : 0;
+        std::cout << "PM sim: " << report.elapsedUs << " us elapsed, residency " << residency / 10 << "." << residency % 10
+                  << "%, " << report.wakeups << " wake-ups, wake latency " << report.wakeLatencyUs << " us\n";
+        return report;
+    }
+
+    // Clock governor. The PLL is left alone (USB needs its 48 MHz output), only the AHB divider moves
+    static const uint32_t perfDividers[PM_PERF_STATES] = {LL_RCC_SYSCLK_DIV_1, LL_RCC_SYSCLK_DIV_2, LL_RCC_SYSCLK_DIV_4, LL_RCC_SYSCLK_DIV_8};
+
+    static uint8_t perfState = PM_PERF_FULL;
+    static uint32_t fullSpeedHz = 0;
+    static bool governorListening = false;
+    static bool governorRunning = false;
+    static uint8_t quietWindows = 0;
+
+    static uint64_t windowStart;
+    static CODAL_TIMESTAMP windowIdleStart;
+    static uint32_t worstBusyUs = 0;
+
+    static void setFlashLatency(uint32_t hclk)
+    {
+        uint32_t latency = (hclk - 1) / PM_FLASH_HZ_PER_WS;
+        MODIFY_REG(FLASH->ACR, FLASH_ACR_LATENCY, latency);
+        while ((FLASH->ACR & FLASH_ACR_LATENCY) != latency)
+        {
+        }
+    }
+
+    bool SetPerfState(uint8_t state)
+    {
+        if (state >= PM_PERF_STATES)
+        {
+            return false;
+        }
+        if (fullSpeedHz == 0)
+        {
+            SystemCoreClockUpdate();
+            fullSpeedHz = SystemCoreClock << perfState;
+        }
+        if (state == perfState)
+        {
+            return true;
+        }
+
+        uint32_t hclk = fullSpeedHz >> state;
+        target_disable_irq();
+        if (state < perfState)
+        {
+            setFlashLatency(hclk); // Faster: add wait states before the clock goes up
+        }
+        LL_RCC_SetAHBPrescaler(perfDividers[state]);
+        if (state > perfState)
+        {
+            setFlashLatency(hclk); // Slower: drop wait states once the clock is down
+        }
+        SystemCoreClockUpdate();
+        perfState = state;
+        target_enable_irq();
+
+        // APB clocks follow HCLK, so everything derived from them needs recomputing
+        codal::system_timer_clock_changed();
+        codal::ZSPI::clockChanged();
+        codal::ZPin::clockChanged(); // Backlight and audio PWM periods
+        return true;
+    }
+
+    uint8_t GetPerfState()
+    {
+        return perfState;
+    }
+
+    void FrameTick(uint32_t busyUs)
+    {
+        if (busyUs > worstBusyUs)
+        {
+            worstBusyUs = busyUs;
+        }
+    }
 
-    void EnterSleepState(uint16_t durationInMinutes)
+    static void onGovernorTick(codal::Event)
     {
-        StopDisplayUpdates(); // Freeze the display to save power
+        if (!governorRunning)
+        {
+            return;
+        }
 
-        std::this_thread::sleep_for(std::chrono::minutes(durationInMinutes)); // Simulate the sleep duration
+        uint64_t now = codal::system_timer_current_time_us();
+        CODAL_TIMESTAMP idleNow = codal::fiber_idle_time_us(); // Time the core actually waited for an interrupt
+        uint32_t window = (uint32_t)(now - windowStart);
+        uint32_t idle = (uint32_t)(idleNow - windowIdleStart);
+        uint32_t busy = window ? 1000 - (uint32_t)((uint64_t)(idle < window ? idle : window) * 1000 / window) : 0;
+        uint32_t frameUs = worstBusyUs;
+        windowStart = now;
+        windowIdleStart = idleNow;
+        worstBusyUs = 0;
 
-        WakeUp(); // Automatically wake up after the sleep duration
+        if (frameUs > PM_FRAME_BUDGET_US)
+        {
+            // A frame's work overran the budget: go straight to full speed
+            quietWindows = 0;
+            SetPerfState(PM_PERF_FULL);
+        }
+        else if (busy > PM_BUSY_HIGH_PERMILLE)
+        {
+            quietWindows = 0;
+            if (perfState > PM_PERF_FULL)
+            {
+                SetPerfState(perfState - 1);
+            }
+        }
+        else if (perfState < PM_PERF_LOWEST && busy * 2 < PM_BUSY_TARGET_PERMILLE &&
+                 (frameUs == 0 || frameUs * 2 < PM_FRAME_BUDGET_US * PM_BUSY_TARGET_PERMILLE / 1000))
+        {
+            // Half the clock doubles the load; step down only if that still leaves headroom
+            if (++quietWindows >= PM_GOVERNOR_HOLD)
+            {
+                quietWindows = 0;
+                SetPerfState(perfState + 1);
+            }
+        }
+        else
+        {
+            quietWindows = 0;
+        }
     }
 
-    static inline void WakeUp()
+    void StartGovernor()
     {
-        screen::sleepmode = false
+        if (governorRunning || !codal::EventModel::defaultEventBus)
+        {
+            return;
+        }
+        if (!governorListening)
+        {
+            codal::EventModel::defaultEventBus->listen(DEVICE_ID_OS_PM, PM_EVT_GOVERNOR, onGovernorTick, MESSAGE_BUS_LISTENER_DROP_IF_BUSY);
+            governorListening = true;
+        }
+        windowStart = codal::system_timer_current_time_us();
+        windowIdleStart = codal::fiber_idle_time_us();
+        worstBusyUs = 0;
+        quietWindows = 0;
+        governorRunning = true;
+        codal::system_timer_event_every_us(PM_GOVERNOR_PERIOD_US, DEVICE_ID_OS_PM, PM_EVT_GOVERNOR);
     }
 
-    static inline void StopDisplayUpdates()
+    void StopGovernor()
     {
-        screen::sleepmode = true
+        if (!governorRunning)
+        {
+            return;
+        }
+        governorRunning = false;
+        codal::system_timer_cancel_event(DEVICE_ID_OS_PM, PM_EVT_GOVERNOR);
+        SetPerfState(PM_PERF_FULL);
     }
 }
 
-// If you add any RAM allocation in PM.cpp, use Kernel::AllocateRAM(size) and Kernel::DeallocateRAM(pointer)
\ No newline at end of file
+// If you add any RAM allocation in PM.cpp, use Kernel::AllocateRAM(size) and Kernel::DeallocateRAM(pointer)
@@ -1,50 +1,235 @@
 #include "VM.h"
 #include "controlgc.cpp" // include GC
-#include "os/declaration/OSconfig.h"
+#include "Flash.h"
+#include "Timer.h"
 #include <iostream>
+#include <chrono>
+#include <cstring>
 
-#ifndef TOTAL_PHYSICAL_MEMORY
-#define TOTAL_PHYSICAL_MEMORY (OS_RAM_SIZE_KB * 1024) // Use value from OSConfig.h
+// Large store access, see FLASH API/settings.cpp
+namespace settings
+{
+    size_t largeStoreSize();
+    uintptr_t largeStoreStart();
+    CODAL_FLASH *largeStoreFlash();
+}
 
+#if VM_LOGGING
+#define VM_LOG(msg) (std::cout << msg)
+#else
+#define VM_LOG(msg) ((void)0)
 #endif
 
 // Page Class Implementation
 Page::Page(uint32_t vAddress, uint32_t pAddress)
-    : virtualAddress(vAddress), physicalAddress(pAddress), allocated(true) {}
+    : virtualAddress(vAddress), physicalAddress(pAddress), allocated(true), resident(true), dirty(false),
+      readOnly(false), referenced(false), shared(false), swapSlot(VM_NO_SWAP_SLOT) {}
 
 uint32_t Page::getVirtualAddress() const { return virtualAddress; }
 uint32_t Page::getPhysicalAddress() const { return physicalAddress; }
 bool Page::isAllocated() const { return allocated; }
+bool Page::isResident() const { return resident; }
+bool Page::isDirty() const { return dirty; }
+bool Page::isReadOnly() const { return readOnly; }
+bool Page::isShared() const { return shared; }
 void Page::deallocate() { allocated = false; }
 
 // PageManager Class Implementation
-PageManager::PageManager() : currentPhysicalAddress(0x00001000) {}
+uint32_t PageManager::freeFrames[VM_FRAME_WORDS];
+uint8_t PageManager::frameRefs[VM_PHYSICAL_FRAMES];
+bool PageManager::framesInitialised = false;
+uint8_t *PageManager::frameMemory = nullptr;
+uintptr_t PageManager::swapStart = 0;
+uint32_t PageManager::swapSlots = 0;
+uint32_t PageManager::swapEraseUnit = 0;
+uint32_t PageManager::swapLive = 0;
+uint32_t PageManager::swapErased = 0;
+Page *PageManager::swapOwner[VM_MAX_SWAP_SLOTS];
+
+PageManager::PageManager() : pendingFrees(0), clockHand(0), stats()
+{
+    if (!framesInitialised)
+    {
+        for (uint32_t i = 0; i < VM_FRAME_WORDS; i++)
+        {
+            uint32_t bits = VM_PHYSICAL_FRAMES - i * 32;
+            freeFrames[i] = bits >= 32 ? 0xFFFFFFFF : (1UL << bits) - 1;
+        }
+        framesInitialised = true;
+    }
+
+    for (auto &entry : pageTable)
+    {
+        entry = nullptr;
+    }
+    for (auto &entry : tlb)
+    {
+        entry.vpn = VM_INVALID_ADDRESS;
+    }
+}
+
+PageManager::~PageManager()
+{
+    for (auto &entry : pageTable)
+    {
+        if (entry)
+        {
+            releasePage(entry);
+            delete entry;
+        }
+    }
+}
+
+// Find `count` contiguous free frames, mark them used and return the first frame index (or -1)
+int32_t PageManager::allocFrames(uint32_t count)
+{
+    if (count == 1)
+    {
+        for (uint32_t i = 0; i < VM_FRAME_WORDS; i++)
+        {
+            if (freeFrames[i])
+            {
+                uint32_t bit = __builtin_ctz(freeFrames[i]);
+                freeFrames[i] &= ~(1UL << bit);
+                frameRefs[i * 32 + bit] = 1;
+                return i * 32 + bit;
+            }
+        }
+        return -1;
+    }
+
+    // Adjacent free frames form one run, so a multi-page request takes the first run long enough
+    uint32_t runStart = 0, runLength = 0;
+    for (uint32_t frame = 0; frame < VM_PHYSICAL_FRAMES; frame++)
+    {
+        if (freeFrames[frame / 32] & (1UL << (frame % 32)))
+        {
+            if (runLength++ == 0)
+            {
+                runStart = frame;
+            }
+            if (runLength == count)
+            {
+                for (uint32_t f = runStart; f < runStart + count; f++)
+                {
+                    freeFrames[f / 32] &= ~(1UL << (f % 32));
+                    frameRefs[f] = 1;
+                }
+                return runStart;
+            }
+        }
+        else
+        {
+            runLength = 0;
+        }
+    }
+    return -1;
+}
+
+// Drop one mapping of a frame; the frame is free once nothing maps it
+void PageManager::releaseFrame(uint32_t pAddress)
+{
+    uint32_t frame = (pAddress - VM_PHYSICAL_BASE) >> VM_PAGE_SHIFT;
+    if (frameRefs[frame] > 1)
+    {
+        frameRefs[frame]--;
+        return;
+    }
+    frameRefs[frame] = 0;
+    freeFrames[frame / 32] |= 1UL << (frame % 32);
+}
+
+// Give back the frame and swap slot held by a page that is being unmapped
+void PageManager::releasePage(Page *page)
+{
+    if (page->resident)
+    {
+        releaseFrame(page->physicalAddress);
+    }
+    releaseSwapSlot(page);
+}
+
+uint32_t PageManager::freePageCount()
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < VM_FRAME_WORDS; i++)
+    {
+        count += __builtin_popcount(freeFrames[i]);
+    }
+    return count;
+}
+
+void PageManager::collect()
+{
+    if (pendingFrees)
+    {
+        pendingFrees = 0;
+        control::gc();
+    }
+}
+
+void PageManager::flushTlbEntry(uint32_t vpn)
+{
+    TlbEntry &entry = tlb[vpn & (VM_TLB_ENTRIES - 1)];
+    if (entry.vpn == vpn)
+    {
+        entry.vpn = VM_INVALID_ADDRESS;
+    }
+}
 
 bool PageManager::allocatePage(uint32_t vAddress)
 {
-    if (currentPhysicalAddress + 0x2000 > TOTAL_PHYSICAL_MEMORY)
+    if (findPage(vAddress))
     {
-        std::cerr << "Error: Out of physical memory!\n";
-        return false;
+        return true; // Already mapped
     }
-    uint32_t pAddress = currentPhysicalAddress;
-    currentPhysicalAddress += 0x2000; // Increment by 8KB
-    Page newPage(vAddress, pAddress);
-    pages.push_back(newPage);
-    std::cout << "Allocated page: Virtual " << vAddress << ", Physical " << pAddress << "\n";
-    return true;
+    return allocatePages(vAddress, 1);
 }
 
-Page *PageManager::findPage(uint32_t vAddress)
+bool PageManager::allocatePages(uint32_t vAddress, uint32_t count)
 {
-    for (auto &page : pages)
+    uint32_t vpn = vAddress >> VM_PAGE_SHIFT;
+    if (count == 0 || vpn + count > VM_VIRTUAL_PAGES)
+    {
+        std::cerr << "Error: Virtual address " << vAddress << " out of range!\n";
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (pageTable[vpn + i])
+        {
+            return false; // Part of the range is already mapped
+        }
+    }
+
+    // With swap enabled, push pages out to flash until a long enough run frees up
+    int32_t frame;
+    while ((frame = allocFrames(count)) < 0 && evictPage())
+    {
+    }
+    if (frame < 0)
     {
-        if (page.getVirtualAddress() == vAddress)
+        std::cerr << "Error: Out of physical memory!\n";
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t pAddress = VM_PHYSICAL_BASE + ((frame + i) << VM_PAGE_SHIFT);
+        pageTable[vpn + i] = new Page((vpn + i) << VM_PAGE_SHIFT, pAddress);
+        if (frameMemory)
         {
-            return &page;
+            memset(frameData(pAddress), 0, VM_PAGE_SIZE);
         }
+        VM_LOG("Allocated page: Virtual " << ((vpn + i) << VM_PAGE_SHIFT) << ", Physical " << pAddress << "\n");
     }
-    return nullptr;
+    return true;
+}
+
+Page *PageManager::findPage(uint32_t vAddress)
+{
+    uint32_t vpn = vAddress >> VM_PAGE_SHIFT;
+    return vpn < VM_VIRTUAL_PAGES ? pageTable[vpn] : nullptr;
 }
 
 bool PageManager::deallocatePage(uint32_t vAddress)
@@ -52,27 +237,382 @@ bool PageManager::deallocatePage(uint32_t vAddress)
     Page *page = findPage(vAddress);
     if (page)
     {
-        page->deallocate();
-        control::gc();
-        std::cout << "Deallocated page: Virtual " << vAddress << "\n";
+        uint32_t vpn = vAddress >> VM_PAGE_SHIFT;
+        flushTlbEntry(vpn);
+        pageTable[vpn] = nullptr;
+        releasePage(page);
+        delete page;
+
+        // Collect once per batch of frees rather than on every page
+        if (++pendingFrees >= VM_GC_BATCH)
+        {
+            collect();
+        }
+        VM_LOG("Deallocated page: Virtual " << vAddress << "\n");
         return true;
     }
     else
     {
-        std::cout << "Page not found for Virtual " << vAddress << "\n";
+        VM_LOG("Page not found for Virtual " << vAddress << "\n");
         return false;
     }
 }
 
-uint32_t PageManager::translateAddress(uint32_t vAddress)
+uint32_t PageManager::translateAddress(uint32_t vAddress, bool write)
 {
+    uint32_t vpn = vAddress >> VM_PAGE_SHIFT;
+    uint32_t offset = vAddress & VM_PAGE_MASK;
+    stats.translations++;
+
+    // Fast path: direct-mapped translation cache
+    TlbEntry &entry = tlb[vpn & (VM_TLB_ENTRIES - 1)];
+    if (entry.vpn == vpn && !(write && (entry.page->readOnly || entry.page->shared)))
+    {
+        entry.page->referenced = true;
+        entry.page->dirty |= write;
+        return entry.pAddress + offset;
+    }
+
     Page *page = findPage(vAddress);
-    if (page && page->isAllocated())
+    if (!page || !page->isAllocated() || (write && page->readOnly))
+    {
+        VM_LOG("Invalid Virtual Address: " << vAddress << "\n");
+        return VM_INVALID_ADDRESS;
+    }
+
+    // Page fault: bring the page back from flash
+    if (!page->resident && !pageIn(page))
+    {
+        return VM_INVALID_ADDRESS;
+    }
+
+    // First write to a shared page: take a private copy
+    if (write && page->shared && !copyOnWrite(page))
+    {
+        return VM_INVALID_ADDRESS;
+    }
+
+    page->referenced = true;
+    page->dirty |= write;
+    entry.vpn = vpn;
+    entry.pAddress = page->getPhysicalAddress();
+    entry.page = page;
+    return entry.pAddress + offset;
+}
+
+bool PageManager::setReadOnly(uint32_t vAddress, bool readOnly)
+{
+    Page *page = findPage(vAddress);
+    if (!page)
+    {
+        return false;
+    }
+    page->readOnly = readOnly;
+    return true;
+}
+
+bool PageManager::mapShared(uint32_t vAddress, PageManager &source, uint32_t sourceVAddress)
+{
+    uint32_t vpn = vAddress >> VM_PAGE_SHIFT;
+    Page *original = source.findPage(sourceVAddress);
+    if (vpn >= VM_VIRTUAL_PAGES || pageTable[vpn] || !original)
+    {
+        return false;
+    }
+
+    // Sharing needs the data in a frame; shared pages then stay resident
+    if (!original->resident && !source.pageIn(original))
+    {
+        return false;
+    }
+
+    // Writes through either mapping must now fault, so drop any cached writable translation
+    source.flushTlbEntry(original->virtualAddress >> VM_PAGE_SHIFT);
+    original->shared = true;
+
+    Page *page = new Page(vpn << VM_PAGE_SHIFT, original->physicalAddress);
+    page->readOnly = original->readOnly;
+    page->shared = true;
+    pageTable[vpn] = page;
+    frameRefs[(original->physicalAddress - VM_PHYSICAL_BASE) >> VM_PAGE_SHIFT]++;
+    VM_LOG("Shared page: Virtual " << vAddress << ", Physical " << original->physicalAddress << "\n");
+    return true;
+}
+
+// Give a shared page its own frame so it can be written
+bool PageManager::copyOnWrite(Page *page)
+{
+    uint32_t oldFrame = (page->physicalAddress - VM_PHYSICAL_BASE) >> VM_PAGE_SHIFT;
+    if (frameRefs[oldFrame] > 1)
+    {
+        int32_t frame;
+        while ((frame = allocFrames(1)) < 0 && evictPage())
+        {
+        }
+        if (frame < 0)
+        {
+            return false;
+        }
+
+        uint32_t pAddress = VM_PHYSICAL_BASE + (frame << VM_PAGE_SHIFT);
+        if (frameMemory)
+        {
+            memcpy(frameData(pAddress), frameData(page->physicalAddress), VM_PAGE_SIZE);
+        }
+        releaseFrame(page->physicalAddress);
+        page->physicalAddress = pAddress;
+        stats.copyOnWrites++;
+    }
+    // The last mapping of a shared frame simply takes it over
+    page->shared = false;
+    return true;
+}
+
+uint8_t *PageManager::frameData(uint32_t pAddress)
+{
+    return frameMemory + (pAddress - VM_PHYSICAL_BASE);
+}
+
+bool PageManager::enableSwap(uint8_t *memory)
+{
+    uintptr_t start = settings::largeStoreStart();
+    if (!memory || start == 0)
+    {
+        return false; // Large store is occupied by the user program
+    }
+
+    CODAL_FLASH *flash = settings::largeStoreFlash();
+    frameMemory = memory;
+    swapStart = start;
+    swapSlots = settings::largeStoreSize() / VM_PAGE_SIZE;
+    if (swapSlots > VM_MAX_SWAP_SLOTS)
+    {
+        swapSlots = VM_MAX_SWAP_SLOTS;
+    }
+    swapEraseUnit = flash->pageSize(start) > (int)VM_PAGE_SIZE ? flash->pageSize(start) : VM_PAGE_SIZE;
+    swapLive = 0;
+    swapErased = 0; // Unknown contents, erased on first use
+    memset(swapOwner, 0, sizeof(swapOwner));
+    return true;
+}
+
+// Erase the units that can be written again, once every erased slot is used up. A unit whose live
+// slots all belong to resident pages counts: their flash copies are given up, and the pages written
+// back again on their next eviction. Units holding an evicted page's only copy are left alone.
+bool PageManager::refillSwap()
+{
+    uint32_t evicted = 0;
+    for (uint32_t slot = 0; slot < swapSlots; slot++)
+    {
+        if (swapOwner[slot] && !swapOwner[slot]->resident)
+        {
+            evicted |= 1UL << slot;
+        }
+    }
+
+    CODAL_FLASH *flash = settings::largeStoreFlash();
+    uint32_t slotsPerUnit = swapEraseUnit / VM_PAGE_SIZE;
+    for (uint32_t first = 0; first < swapSlots; first += slotsPerUnit)
+    {
+        uint32_t count = first + slotsPerUnit > swapSlots ? swapSlots - first : slotsPerUnit;
+        uint32_t mask = (count >= 32 ? 0xFFFFFFFF : (1UL << count) - 1) << first;
+        if ((evicted & mask) || (swapErased & mask) == mask)
+        {
+            continue;
+        }
+
+        for (uint32_t slot = first; slot < first + count; slot++)
+        {
+            if (Page *owner = swapOwner[slot])
+            {
+                releaseSwapSlot(owner);
+                owner->dirty = true;
+            }
+        }
+        uintptr_t addr = swapStart + first * VM_PAGE_SIZE;
+        for (uintptr_t end = addr + swapEraseUnit; addr < end; addr += flash->pageSize(addr))
+        {
+            flash->erasePage(addr);
+        }
+        swapErased |= mask;
+    }
+    return swapErased != 0;
+}
+
+// Take an erased swap slot, refilling the swap region if none is left
+int32_t PageManager::takeSwapSlot()
+{
+    if (swapErased == 0 && !refillSwap())
+    {
+        return VM_NO_SWAP_SLOT; // Every erase unit still holds an evicted page
+    }
+
+    int32_t slot = __builtin_ctz(swapErased);
+    swapErased &= ~(1UL << slot);
+    return slot;
+}
+
+void PageManager::releaseSwapSlot(Page *page)
+{
+    if (page->swapSlot != VM_NO_SWAP_SLOT)
+    {
+        swapLive &= ~(1UL << page->swapSlot);
+        swapOwner[page->swapSlot] = nullptr;
+        page->swapSlot = VM_NO_SWAP_SLOT;
+    }
+}
+
+// Push one page out of RAM, chosen by the clock algorithm
+bool PageManager::evictPage()
+{
+    if (!swapStart)
     {
-        return page->getPhysicalAddress();
+        return false;
+    }
+
+    // Dirty pages can only go while there is a slot to write them to
+    bool canWriteBack = swapErased != 0 || refillSwap();
+
+    // Two sweeps: the first clears referenced bits, the second is guaranteed to find a victim
+    Page *victim = nullptr;
+    for (uint32_t i = 0; i < 2 * VM_VIRTUAL_PAGES && !victim; i++)
+    {
+        Page *page = pageTable[clockHand];
+        clockHand = (clockHand + 1) % VM_VIRTUAL_PAGES;
+        if (!page || !page->resident)
+        {
+            continue;
+        }
+        if (page->shared)
+        {
+            // Other address spaces map this frame, so it can't move; a sole survivor is private again
+            if (frameRefs[(page->physicalAddress - VM_PHYSICAL_BASE) >> VM_PAGE_SHIFT] > 1)
+            {
+                continue;
+            }
+            page->shared = false;
+        }
+        if (page->dirty && !canWriteBack)
+        {
+            continue;
+        }
+        if (page->referenced)
+        {
+            page->referenced = false;
+            continue;
+        }
+        victim = page;
+    }
+    if (!victim)
+    {
+        return false;
+    }
+
+    // Clean pages with a flash copy (and never-written zero pages) are dropped for free
+    if (victim->dirty)
+    {
+        int32_t slot = takeSwapSlot();
+        if (slot == VM_NO_SWAP_SLOT)
+        {
+            return false;
+        }
+
+        CODAL_FLASH *flash = settings::largeStoreFlash();
+        uintptr_t dst = swapStart + slot * VM_PAGE_SIZE;
+        const uint8_t *src = frameData(victim->physicalAddress);
+        for (uint32_t done = 0; done < VM_PAGE_SIZE;)
+        {
+            uint32_t pageSize = flash->pageSize(dst + done);
+            uint32_t chunk = pageSize - ((dst + done) % pageSize);
+            if (chunk > VM_PAGE_SIZE - done)
+            {
+                chunk = VM_PAGE_SIZE - done;
+            }
+            flash->writeBytes(dst + done, src + done, chunk);
+            done += chunk;
+        }
+
+        releaseSwapSlot(victim);
+        victim->swapSlot = slot;
+        swapLive |= 1UL << slot;
+        swapOwner[slot] = victim;
+        victim->dirty = false;
+        stats.writebacks++;
+    }
+
+    flushTlbEntry(victim->virtualAddress >> VM_PAGE_SHIFT);
+    releaseFrame(victim->physicalAddress);
+    victim->resident = false;
+    stats.evictions++;
+    VM_LOG("Evicted page: Virtual " << victim->virtualAddress << "\n");
+    return true;
+}
+
+bool PageManager::pageIn(Page *page)
+{
+    uint32_t start = codal::system_timer_current_time_us();
+
+    int32_t frame;
+    while ((frame = allocFrames(1)) < 0 && evictPage())
+    {
+    }
+    if (frame < 0)
+    {
+        return false;
+    }
+
+    page->physicalAddress = VM_PHYSICAL_BASE + (frame << VM_PAGE_SHIFT);
+    if (page->swapSlot != VM_NO_SWAP_SLOT)
+    {
+        // The large store is memory mapped, so paging in is a plain copy
+        memcpy(frameData(page->physicalAddress), (const void *)(swapStart + page->swapSlot * VM_PAGE_SIZE), VM_PAGE_SIZE);
+    }
+    else
+    {
+        memset(frameData(page->physicalAddress), 0, VM_PAGE_SIZE);
+    }
+    page->resident = true;
+    page->dirty = false;
+
+    uint32_t elapsed = codal::system_timer_current_time_us() - start;
+    stats.faults++;
+    stats.pageInUsTotal += elapsed;
+    if (elapsed > stats.pageInUsMax)
+    {
+        stats.pageInUsMax = elapsed;
+    }
+    return true;
+}
+
+namespace VM
+{
+    uint32_t BenchmarkTranslations(uint32_t pagesMapped, uint32_t iterations)
+    {
+        PageManager manager;
+        uint32_t mapped = 0;
+        while (mapped < pagesMapped && manager.allocatePage(mapped << VM_PAGE_SHIFT))
+        {
+            mapped++;
+        }
+        if (mapped == 0 || iterations == 0)
+        {
+            return 0;
+        }
+
+        // Stride through the mapped pages so both TLB hits and misses are measured
+        volatile uint32_t sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            uint32_t vAddress = ((i * 7) % mapped) << VM_PAGE_SHIFT | (i & VM_PAGE_MASK);
+            sink = sink + manager.translateAddress(vAddress);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        uint32_t perSecond = elapsed > 0 ? (uint32_t)((uint64_t)iterations * 1000000 / elapsed) : 0;
+        std::cout << "VM: " << iterations << " translations over " << mapped << " pages, " << perSecond << " translations/s\n";
+        return perSecond;
     }
-    std::cout << "Invalid Virtual Address: " << vAddress << "\n";
-    return 0xFFFFFFFF;
 }
 
 // If you add any RAM allocation in VM.cpp, use Kernel::AllocateRAM(size) and Kernel::DeallocateRAM(pointer)
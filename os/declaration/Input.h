@@ -3,6 +3,7 @@
 
 #include <cstdint> // Ensures uint8_t is defined
 #include "configkeys.h"
+#include "CodalSlabAllocator.h"
 // 🎮 **High-Level Button Definitions**
 // These constants represent button IDs used for input detection.
 #define BTN_A 1          // A button
@@ -14,6 +15,25 @@
 #define BTN_MENU 7       // Menu Button
 #define BTN_SOFT_RESET 8 // Reset Button
 #define BTN_NULL_ID 0    // the ID for a NULL Button
+#define BTN_COUNT 8      // Number of physical buttons (BTN_A .. BTN_SOFT_RESET)
+
+// ⏱️ **Input Event Queue**
+#define INPUT_QUEUE_SIZE 32 // Must be a power of two
+#define INPUT_EVT_PRESS 1   // Button went down (debounced)
+#define INPUT_EVT_RELEASE 2 // Button went up (debounced)
+#define INPUT_EVT_HOLD 3    // Button held for DEVICE_BUTTON_HOLD_TIME
+
+// ⏺️ **Record / Replay**
+#define INPUT_RECORD_MAX 512         // Events kept by one recording
+#define INPUT_RECORD_MAGIC 0x32455249 // "IRE2", the header holds the frame count
+
+// ⏲️ **Input-to-Photon Latency**
+#define INPUT_LATENCY_DISPATCH 0 // Debounced edge -> dequeued by the app
+#define INPUT_LATENCY_RENDER 1   // Dequeued -> frame render complete
+#define INPUT_LATENCY_TRANSFER 2 // Render complete -> frame's SPI transfer done
+#define INPUT_LATENCY_TOTAL 3    // Debounced edge -> frame's SPI transfer done
+#define INPUT_LATENCY_STAGES 4
+#define INPUT_LATENCY_BUCKETS 10 // <1 ms, then powers of two up to >= 256 ms
 
 // Declare external button instances
 extern Button A;  // Button A
@@ -75,6 +95,9 @@ public:
      * @return `true` if the button is being pressed, otherwise `false`.
      */
     bool isPressed() const;
+
+    // Allocated by GetButtonFromID, so keep these off the shared heap
+    SLAB_ALLOCATED
 };
 
 /**
@@ -141,6 +164,9 @@ public:
      * @return `true` if the button is pressed, otherwise `false`.
      */
     bool isPressed() const { return pressed; }
+
+    // Allocated by MakeVirtual, so keep these off the shared heap
+    SLAB_ALLOCATED
 };
 
 // 🔍 **Button Detection Functions**
@@ -185,4 +211,172 @@ Button* GetButtonFromID(uint8_t id);
  */
 VirtualButton* MakeVirtual(Button* button);
 
-#endif /* I_H */
\ No newline at end of file
+/**
+ * @brief A debounced button transition, timestamped when it was detected.
+ */
+struct InputEvent
+{
+    uint32_t timeUs; // system_timer_current_time_us() at detection
+    uint8_t button;  // BTN_* ID
+    uint8_t type;    // INPUT_EVT_*
+};
+
+/**
+ * @brief Starts debounced, event driven input.
+ *
+ * Each button gets a CODAL button sampled on the system tick with sigma filtering. Its
+ * transitions are pushed into a lock-free ring of INPUT_QUEUE_SIZE events, and the
+ * button state functions above answer from the debounced state instead of reading pins.
+ * Called on first use of any of them, so calling it explicitly is optional.
+ * @return `true` once input events are running.
+ */
+bool StartInputEvents();
+
+/**
+ * @brief Moves queued input events into `out`, oldest first. Call once per frame.
+ * @param out Destination array.
+ * @param max Capacity of `out`.
+ * @return Number of events copied.
+ */
+uint8_t DrainInputEvents(InputEvent *out, uint8_t max);
+
+/**
+ * @brief Number of events lost because the queue was full when they arrived.
+ */
+uint32_t DroppedInputEvents();
+
+// 📸 **Port Snapshot**
+/**
+ * @brief All buttons sampled at one instant. Bit `1 << BTN_*` per button.
+ */
+struct InputSnapshot
+{
+    uint16_t held;     // Pressed now
+    uint16_t pressed;  // Pressed now, not at the previous SampleInput()
+    uint16_t released; // Pressed at the previous SampleInput(), not now
+};
+
+/**
+ * @brief Builds the (GPIO port, pin mask) table for every configured button.
+ *
+ * Call once at boot; SampleInput() builds it on first use otherwise.
+ */
+void BuildInputPortMap();
+
+/**
+ * @brief Reads every button with one input register load per GPIO port.
+ *
+ * Raw, undebounced levels with no edge tracking; safe while the system tick is stopped.
+ * @return Bit `1 << BTN_*` per pressed button.
+ */
+uint16_t ReadInputPorts();
+
+/**
+ * @brief Arms (or disarms) an edge interrupt on every button pin so a press wakes the core from sleep.
+ *
+ * A button whose EXTI line is already taken, by another pin or a button with the same pin number
+ * on another port, is skipped.
+ * @param armed `true` before halting, `false` once awake again.
+ * @return `false` if some button could not be armed and has to be polled.
+ */
+bool ArmButtonWake(bool armed);
+
+/**
+ * @brief Samples all buttons and reports the edges since the previous call. Call once per frame.
+ *
+ * While a recording is replaying, the buttons are the replayed ones, not the pins.
+ */
+InputSnapshot SampleInput();
+
+/**
+ * @brief A recorded input event and the frame it arrived in. `event.timeUs` is relative to the start of the recording.
+ */
+struct InputRecord
+{
+    uint32_t frame;
+    InputEvent event;
+};
+
+/**
+ * @brief Frame timing of the current (or last) recording or replay, for comparing runs between builds.
+ */
+struct InputRunStats
+{
+    uint32_t frames;
+    uint32_t totalUs;
+    uint32_t worstFrameUs;
+};
+
+/**
+ * @brief Marks the end of a displayed frame; called by screen::update.
+ *
+ * Numbers frames for recording, applies replayed events that belong to the new frame
+ * and accumulates the frame time in the run statistics.
+ */
+void AdvanceInputFrame();
+
+/**
+ * @brief Starts logging every input event with its frame number and time.
+ * @return `false` if a replay is running or the log couldn't be allocated.
+ */
+bool StartInputRecording();
+
+/**
+ * @brief Stops recording and stores the log in the settings file system under `key`.
+ * @return `true` if the log was written.
+ */
+bool StopInputRecording(const char *key);
+
+/**
+ * @brief Replays the log stored under `key`.
+ *
+ * Physical buttons are ignored until the replay ends. Each event is applied to a
+ * VirtualButton at the frame it was recorded in, and queued with its recorded time, so
+ * isPressed, WhatButtonPressed and DrainInputEvents see exactly the recorded input.
+ * @return `false` if the log is missing or malformed.
+ */
+bool StartInputReplay(const char *key);
+
+/**
+ * @brief Ends a replay (also happens on its own after the last event) and prints the run statistics.
+ */
+void StopInputReplay();
+
+bool IsReplayingInput();
+
+const InputRunStats &GetInputRunStats();
+
+/**
+ * @brief Latency distribution of one stage of the input-to-photon path.
+ *
+ * Bucket 0 counts samples under 1 ms, bucket n samples in [2^(n-1), 2^n) ms,
+ * and the last bucket everything longer.
+ */
+struct InputLatencyHistogram
+{
+    uint32_t bucket[INPUT_LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t maxUs;
+    uint64_t totalUs;
+};
+
+/**
+ * @brief Marks a display DMA transfer as finished; called by the SPI driver.
+ *
+ * A frame may go out in several transfers, so the last one before the next frame counts.
+ */
+void MarkDisplayTransferDone();
+
+/**
+ * @brief Latency histogram of one stage (INPUT_LATENCY_*), or nullptr for an invalid stage.
+ */
+const InputLatencyHistogram *GetInputLatency(uint8_t stage);
+
+/**
+ * @brief Prints every latency histogram to DMESG (and so to HF2), with the debounce delay for reference.
+ */
+void DumpInputLatency();
+
+void ResetInputLatency();
+
+#endif /* I_H */
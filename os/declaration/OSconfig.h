@@ -7,4 +7,10 @@
 // You can adjust this value based on your system's memory size.
 #define OS_RAM_SIZE_KB 128 // Set to 96, 128, or 256 as needed
 
-#endif
\ No newline at end of file
+// Message bus IDs used by OS services (taken from the CODAL dynamic ID range)
+#define DEVICE_ID_OS_THREADING 64100 // Thread scheduler timeslice tick
+#define DEVICE_ID_OS_PM 64101        // PM governor sampling tick
+#define DEVICE_ID_OS_DISPLAY 64102   // Display transfer finished
+#define DEVICE_ID_OS_INPUT 64110     // Debounced buttons, DEVICE_ID_OS_INPUT + BTN_* ID
+
+#endif
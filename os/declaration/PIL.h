@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include "CodalSlabAllocator.h"
+#include "kernel/Kernel.h"
 
 /**
  * the PIL (Program interface layer) for interacting with the OS
@@ -77,6 +79,9 @@ namespace PIL
          */
         char *name();
 
+        // Files are opened and closed constantly, so allocate them from the slab pools
+        SLAB_ALLOCATED
+
     private:
         const char *fileName; // Name of the file.
         uint32_t appID;       // Application ID associated with the file.
@@ -186,6 +191,26 @@ namespace PIL
      */
     void RegisterTask(std::function<void()> taskFunction, bool visible = true);
 
+    /**
+     * @brief Launches an app with its own RAM arena.
+     *
+     * The app gets an ID from `makeNewAppId`, an arena of `arenaBytes` that serves its
+     * `AllocateRAM` calls, and `entry` as its task.
+     *
+     * @param name The name of the app.
+     * @param entry The app's task, run on every `RunTasks` pass.
+     * @param arenaBytes RAM reserved for the app.
+     * @return The app's ID, or -1 if it is already running or the RAM budget is exhausted.
+     */
+    int LaunchApp(const std::string &name, std::function<void()> entry, uint32_t arenaBytes = KERNEL_DEFAULT_ARENA_BYTES);
+
+    /**
+     * @brief Exits an app, dropping its tasks and releasing its whole arena.
+     *
+     * @param appID The ID returned by `LaunchApp`.
+     */
+    void ExitApp(uint32_t appID);
+
     /**
      * @brief Clears all cached files from RAM.
      *
@@ -229,4 +254,4 @@ namespace PIL
     void Mount();
 }
 
-#endif // PIL_H
\ No newline at end of file
+#endif // PIL_H
@@ -3,8 +3,104 @@
 
 #include <cstdint>
 
+#define PM_WAKE_TIMEOUT 0 // Requested duration elapsed
+#define PM_WAKE_BUTTON 1  // A button changed state
+#define PM_WAKE_TIMER 2   // A timer event flagged CODAL_TIMER_EVENT_FLAGS_WAKEUP fell due
+
+// Cost the simulation charges for every wake-up (oscillator restart and pin check)
+#ifndef PM_SIM_WAKE_COST_US
+#define PM_SIM_WAKE_COST_US 40
+#endif
+
+// Performance states, fastest first. Each state halves the core (AHB) clock of the one before
+#define PM_PERF_STATES 4
+#define PM_PERF_FULL 0
+#define PM_PERF_LOWEST (PM_PERF_STATES - 1)
+
+#ifndef PM_GOVERNOR_PERIOD_US
+#define PM_GOVERNOR_PERIOD_US 250000 // Governor sampling window
+#endif
+
+#define PM_FRAME_BUDGET_US 16667    // One frame at 60 FPS
+#define PM_BUSY_HIGH_PERMILLE 850   // Busier than this, speed up
+#define PM_BUSY_TARGET_PERMILLE 600 // Slow down only if the predicted load stays under this
+#define PM_GOVERNOR_HOLD 4          // Quiet windows in a row before stepping down
+#define PM_EVT_GOVERNOR 1
+
+#ifndef PM_BUTTON_POLL_US
+#define PM_BUTTON_POLL_US 20000 // Longest halt while some button has no wake-up interrupt
+#endif
+
 namespace PM {
+    /**
+     * @brief Outcome of the last sleep.
+     *
+     * Residency is `sleptUs / elapsedUs`: the share of the sleep spent with the core halted
+     * rather than awake checking whether it should stay asleep.
+     */
+    struct SleepReport
+    {
+        uint64_t requestedUs;   // Duration asked for
+        uint64_t elapsedUs;     // Wall clock time from entering to leaving sleep
+        uint64_t sleptUs;       // Time spent with the core halted
+        uint32_t wakeups;       // Times the core woke before the sleep ended
+        uint32_t wakeLatencyUs; // From the wake cause (button edge or deadline) to leaving sleep
+        uint8_t reason;         // PM_WAKE_*
+    };
+
     void EnterSleepState(uint32_t durationInMinutes); // Enter sleep mode for a set duration
+
+    /**
+     * @brief Put the display and core to sleep for `durationUs` or until a button changes state.
+     *
+     * The system timer's interrupt is handed over to PM for the duration, and the time spent
+     * asleep is folded back in afterwards, so timestamps and timer events stay correct. The button
+     * pins get edge interrupts while asleep; if one can't, halts are capped to PM_BUTTON_POLL_US.
+     * @return The report also returned by `LastSleep()`.
+     */
+    const SleepReport &SleepFor(uint64_t durationUs);
+
+    const SleepReport &LastSleep();
+
+    /**
+     * @brief Run the sleep loop against a simulated clock, for host side tuning.
+     *
+     * @param durationUs Requested sleep.
+     * @param buttonAtUs When a button edge happens, relative to the start (0 for never).
+     * @param interruptPeriodUs How often some other interrupt wakes the core (0 for never).
+     * @param edgeWake Whether a button edge wakes the core itself; if not, it's only noticed on the next wake-up.
+     * @return A report of the simulated sleep.
+     */
+    SleepReport SimulateSleep(uint64_t durationUs, uint64_t buttonAtUs, uint64_t interruptPeriodUs, bool edgeWake);
+
+    /**
+     * @brief Start the clock governor.
+     *
+     * Every PM_GOVERNOR_PERIOD_US it compares the time the core spent idle and the busiest frame
+     * against the frame budget, stepping up at once when a frame's work overran it and stepping
+     * down one state after PM_GOVERNOR_HOLD quiet windows. The ticks are handled in a fiber and
+     * dropped while the previous one is still switching.
+     */
+    void StartGovernor();
+
+    void StopGovernor();
+
+    /**
+     * @brief Switch to a performance state, rescaling the system timer, SPI clocks and PWM outputs.
+     *
+     * Spins on the flash latency and recalibrates the timer, so call it from a fiber, not an interrupt.
+     * @param state PM_PERF_FULL .. PM_PERF_LOWEST.
+     * @return `false` if the state is out of range.
+     */
+    bool SetPerfState(uint8_t state);
+
+    uint8_t GetPerfState();
+
+    /**
+     * @brief Mark the end of a displayed frame; called by screen::update.
+     * @param busyUs Time the frame kept the CPU busy: rendering and pushing, not waiting for vsync.
+     */
+    void FrameTick(uint32_t busyUs);
 }
 
-#endif // PM_H
\ No newline at end of file
+#endif // PM_H
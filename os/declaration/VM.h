@@ -2,37 +2,188 @@
 #define VM_H
 
 #include <cstdint>
-#include <vector>
+#include "CodalSlabAllocator.h"
+#include "os/declaration/OSconfig.h"
+
+#ifndef TOTAL_PHYSICAL_MEMORY
+#define TOTAL_PHYSICAL_MEMORY (OS_RAM_SIZE_KB * 1024) // Use value from OSConfig.h
+#endif
+
+#define VM_PAGE_SHIFT 13                   // 8 KB pages
+#define VM_PAGE_SIZE (1UL << VM_PAGE_SHIFT)
+#define VM_PAGE_MASK (VM_PAGE_SIZE - 1)
+#define VM_VIRTUAL_PAGES 256               // Virtual pages per PageManager (2 MB address space)
+#define VM_TLB_ENTRIES 8                   // Direct-mapped translation cache, must be a power of 2
+#define VM_INVALID_ADDRESS 0xFFFFFFFF
+#define VM_PHYSICAL_BASE 0x00001000        // First physical address handed out to pages
+#define VM_PHYSICAL_FRAMES ((TOTAL_PHYSICAL_MEMORY - VM_PHYSICAL_BASE) >> VM_PAGE_SHIFT)
+#define VM_FRAME_WORDS ((VM_PHYSICAL_FRAMES + 31) / 32)
+#define VM_MAX_SWAP_SLOTS 32               // Swap slots tracked in one bitmap word
+#define VM_NO_SWAP_SLOT -1
+
+#ifndef VM_GC_BATCH
+#define VM_GC_BATCH 4 // Page frees between garbage collections
+#endif
+
+// Set VM_LOGGING to 1 to trace page allocation to std::cout
+#ifndef VM_LOGGING
+#define VM_LOGGING 0
+#endif
 
 // Page Class
 class Page
 {
+    friend class PageManager;
+
 private:
     uint32_t virtualAddress;
     uint32_t physicalAddress;
     bool allocated;
+    bool resident;   // Backed by a physical frame right now
+    bool dirty;      // Written since it was last paged in
+    bool readOnly;   // Writes are refused, so the page never needs writing back
+    bool referenced; // Clock bit, set on every translation
+    bool shared;     // Frame is mapped copy-on-write into more than one address space
+    int8_t swapSlot; // Slot holding the page's flash copy, or VM_NO_SWAP_SLOT
 
 public:
     Page(uint32_t vAddress, uint32_t pAddress);
     uint32_t getVirtualAddress() const;
     uint32_t getPhysicalAddress() const;
     bool isAllocated() const;
+    bool isResident() const;
+    bool isDirty() const;
+    bool isReadOnly() const;
+    bool isShared() const;
     void deallocate();
+
+    // Pages come and go with every level load, keep them off the shared heap
+    SLAB_ALLOCATED
+};
+
+// Paging counters, see PageManager::getStats()
+struct VMStats
+{
+    uint32_t translations; // Calls to translateAddress
+    uint32_t faults;       // Translations that had to page in
+    uint32_t evictions;    // Pages pushed out of RAM
+    uint32_t writebacks;   // Evictions that had to write a dirty page to flash
+    uint32_t copyOnWrites; // Shared pages copied on their first write
+    uint32_t pageInUsTotal; // Time spent servicing faults, in microseconds
+    uint32_t pageInUsMax;   // Slowest fault, in microseconds
 };
 
 // PageManager Class
 class PageManager
 {
 private:
-    std::vector<Page> pages;
-    uint32_t currentPhysicalAddress;
+    struct TlbEntry
+    {
+        uint32_t vpn;      // Virtual page number, VM_INVALID_ADDRESS when empty
+        uint32_t pAddress; // Physical base address of the page
+        Page *page;
+    };
+
+    Page *pageTable[VM_VIRTUAL_PAGES]; // Indexed by virtual page number
+    TlbEntry tlb[VM_TLB_ENTRIES];
+    uint32_t pendingFrees;             // Frees since the last garbage collection
+    uint32_t clockHand;
+    VMStats stats;
+
+    // Physical memory is shared by every address space
+    static uint32_t freeFrames[VM_FRAME_WORDS]; // Bit set for every free physical page frame
+    static uint8_t frameRefs[VM_PHYSICAL_FRAMES]; // Pages mapping each frame
+    static bool framesInitialised;
+
+    // Demand paging state
+    static uint8_t *frameMemory;   // RAM backing physical frames, nullptr until swap is enabled
+    static uintptr_t swapStart;    // Swap region in the large store, 0 when swap is disabled
+    static uint32_t swapSlots;
+    static uint32_t swapEraseUnit; // Bytes erased at a time, a multiple of VM_PAGE_SIZE
+    static uint32_t swapLive;      // Bit set for every slot holding a page's current copy
+    static uint32_t swapErased;    // Bit set for every slot that can be written
+    static Page *swapOwner[VM_MAX_SWAP_SLOTS]; // Page whose copy each live slot holds
+
+    void flushTlbEntry(uint32_t vpn);
+    static int32_t allocFrames(uint32_t count);
+    static void releaseFrame(uint32_t pAddress);
+    void releasePage(Page *page);
+    bool copyOnWrite(Page *page);
+    uint8_t *frameData(uint32_t pAddress);
+    bool refillSwap();
+    int32_t takeSwapSlot();
+    void releaseSwapSlot(Page *page);
+    bool evictPage();
+    bool pageIn(Page *page);
 
 public:
     PageManager();
-    void allocatePage(uint32_t vAddress);
+    ~PageManager();
+    bool allocatePage(uint32_t vAddress);
+
+    /**
+     * Map `count` consecutive virtual pages starting at `vAddress` onto physically contiguous frames.
+     * @return false if the range is out of bounds, partly mapped, or no run of free frames is long enough.
+     */
+    bool allocatePages(uint32_t vAddress, uint32_t count);
     Page *findPage(uint32_t vAddress);
-    void deallocatePage(uint32_t vAddress);
-    uint32_t translateAddress(uint32_t vAddress);
+    bool deallocatePage(uint32_t vAddress);
+
+    /**
+     * Translate a virtual address, paging the page back in from flash if it was evicted.
+     * @param write Set for write accesses; marks the page dirty and fails on read-only pages.
+     * @return The physical address, or VM_INVALID_ADDRESS.
+     */
+    uint32_t translateAddress(uint32_t vAddress, bool write = false);
+
+    /**
+     * Mark a mapped page read-only. Read-only pages are evicted without a write back once they have a flash copy.
+     */
+    bool setReadOnly(uint32_t vAddress, bool readOnly = true);
+
+    /**
+     * Map the page at `sourceVAddress` of `source` into this address space at `vAddress`, sharing its
+     * physical frame. Both mappings become copy-on-write: the first write through either one gets a
+     * private copy. Shared pages stay resident.
+     * @return false if the source page doesn't exist or `vAddress` is already mapped.
+     */
+    bool mapShared(uint32_t vAddress, PageManager &source, uint32_t sourceVAddress);
+
+    /**
+     * Back evicted pages with the swap region of the large store (settings::largeStoreStart).
+     *
+     * Slots are written in turn and only reused after their erase unit is erased, which needs every
+     * slot in it to be free. The large store is a single 128 KB sector, so once it has filled up the
+     * copies of pages back in RAM are dropped to free it; while any evicted page still has its copy
+     * in the sector it can't be erased, dirty pages stay in RAM and only clean pages are evicted.
+     * @param memory RAM holding the physical frames, TOTAL_PHYSICAL_MEMORY - VM_PHYSICAL_BASE bytes.
+     * @return false if the large store is occupied by the user program.
+     */
+    static bool enableSwap(uint8_t *memory);
+
+    /**
+     * Paging counters since the PageManager was created.
+     */
+    const VMStats &getStats() const { return stats; }
+
+    /**
+     * Run any garbage collection deferred by deallocatePage.
+     */
+    void collect();
+
+    /**
+     * Number of physical page frames currently free.
+     */
+    static uint32_t freePageCount();
 };
 
-#endif // VM_H
\ No newline at end of file
+namespace VM
+{
+    /**
+     * Map `pagesMapped` pages in a fresh PageManager and time `iterations` translations over them.
+     * @return Translations per second.
+     */
+    uint32_t BenchmarkTranslations(uint32_t pagesMapped, uint32_t iterations);
+}
+
+#endif // VM_H
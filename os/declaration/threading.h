@@ -3,29 +3,77 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "CodalFiber.h"
 
 #define MAX_THREADS 8
 #define MAX_PRIORITY 250    // Non-system priority limit
 #define SYSTEM_PRIORITY 254 // Reserved priority for system-critical tasks
 
+#define THREAD_NONE 255          // Sentinel value for "no thread"
+#define THREAD_FOREIGN 254       // Mutex owner that is not a thread: another fiber, or a waiter handed the lock but not yet running
+#define THREAD_PRIORITY_LEVELS 32 // Run queue levels; priorities are grouped 8 to a level
+#define THREAD_PRIORITY_SHIFT 3   // priority >> THREAD_PRIORITY_SHIFT gives the run queue level
+
+#ifndef THREAD_TIMESLICE_US
+#define THREAD_TIMESLICE_US 4000 // Timer tick period driving timeslice accounting
+#endif
+
+#ifndef THREAD_TIMESLICE_TICKS
+#define THREAD_TIMESLICE_TICKS 2 // Ticks a thread may keep the CPU while peers of the same level wait
+#endif
+
+#define THREAD_EVT_TICK 1
+
 /**
  * @typedef Thread
  * @brief Represents a lightweight thread/task in ARCADEOS.
- * 
+ *
  * Each thread is a function pointer with optional metadata like blocking status and priority.
+ * The task is run repeatedly on its own CODAL fiber; each return from `task` is a
+ * scheduling point at which a higher priority thread (or an expired timeslice) takes over.
  */
 typedef struct {
     uint8_t id;                 /**< Unique thread ID (assigned at creation) */
     void (*task)(void);         /**< Task function to be executed by the thread */
     bool isBlocked;             /**< Indicates if the thread is currently blocked */
-    uint8_t priority;           /**< Thread priority (0–255) */
+    bool inMutex;               /**< Parked in ThreadMutex::wait(); only the mutex may wake it */
+    uint8_t priority;           /**< Effective thread priority (0–255), may be raised by priority inheritance */
+    uint8_t basePriority;       /**< Priority assigned by createThread/setThreadPriority */
+    codal::Fiber *fiber;        /**< CODAL fiber the task runs on */
 } Thread;
 
+/**
+ * @class ThreadMutex
+ * @brief A FiberLock based mutex with priority inheritance.
+ *
+ * When a thread blocks on a mutex held by a lower priority thread, the holder runs at the
+ * waiter's priority until it calls `unlock()`, so a rendering thread holding a shared
+ * resource can't starve the audio or input thread waiting for it.
+ */
+class ThreadMutex
+{
+public:
+    ThreadMutex() : lock(1, codal::FiberLockMode::MUTEX), owner(THREAD_NONE) {}
+
+    /**
+     * Block the calling thread until the mutex is available.
+     */
+    void wait();
+
+    /**
+     * Release the mutex, dropping any inherited priority and waking one waiter.
+     */
+    void notify();
+
+private:
+    codal::FiberLock lock;
+    uint8_t owner; // Thread ID of the holder, THREAD_FOREIGN, or THREAD_NONE when free
+};
 
 /**
  * @function createThread
  * @brief Creates and registers a new thread.
- * 
+ *
  * @param task Function pointer to the thread task.
  * @param priority Priority level (must be ≤ MAX_PRIORITY).
  * @return `true` on success, `false` if thread pool is full or parameters are invalid.
@@ -35,16 +83,31 @@ bool createThread(void (*task)(void), uint8_t priority);
 /**
  * @function switchThread
  * @brief Switches execution to the next unblocked thread with the highest priority.
- * 
- * This uses a priority-based round-robin mechanism.
+ *
+ * The run queue keeps one bit per priority level, so picking the next thread is O(1).
+ * Threads within the same level are scheduled round-robin.
+ * Called from a thread this is a voluntary yield; called from outside it dispatches
+ * the highest priority ready thread.
  * @return `true` if a thread was successfully switched, `false` otherwise.
  */
 bool switchThread();
 
+/**
+ * @function yieldThread
+ * @brief Preemption point for long running tasks.
+ *
+ * Hands the CPU over only if a higher priority thread became ready or the timeslice
+ * expired; otherwise returns immediately.
+ * @return `true` if another thread ran before returning, `false` otherwise.
+ */
+bool yieldThread();
+
 /**
  * @function unblockThread
  * @brief Unblocks a thread by ID.
- * 
+ *
+ * If the thread outranks the running thread, it preempts it at the next scheduling point.
+ * A thread waiting on a ThreadMutex is left alone: it runs again once it has the lock.
  * @param id Thread ID to unblock.
  * @return `true` if the thread exists and was unblocked, `false` otherwise.
  */
@@ -53,22 +116,29 @@ bool unblockThread(uint8_t id);
 /**
  * @function blockCurrentThread
  * @brief Blocks the currently active thread.
- * 
- * Only works for non-system threads.
+ *
+ * Only works for non-system threads. Returns once the thread has been unblocked and dispatched again.
  * @return `true` if blocked successfully, `false` otherwise.
  */
-static bool blockCurrentThread();
+bool blockCurrentThread();
 
 /**
  * @function setThreadPriority
  * @brief Sets a new priority level for a thread.
- * 
+ *
  * @param id Thread ID.
  * @param priority New priority value (≤ MAX_PRIORITY).
  * @return `true` if updated successfully, `false` otherwise.
  */
-static bool setThreadPriority(uint8_t id, uint8_t priority);
+bool setThreadPriority(uint8_t id, uint8_t priority);
 
-#endif
+/**
+ * @function threadIdleTimeUs
+ * @brief Total time no thread held the CPU since boot.
+ *
+ * Sampled periodically by the PM governor to measure idle residency.
+ * @return Idle time in microseconds.
+ */
+uint64_t threadIdleTimeUs();
 
-#endif // ARCADEOS_THREADING_H
\ No newline at end of file
+#endif // ARCADEOS_THREADING_H
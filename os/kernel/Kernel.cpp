@@ -3,12 +3,18 @@
 #include "os/declaration/OSconfig.h"
 #include <algorithm>
 #include <iostream>
+#include <list>
+#include <new>
 
 namespace Kernel {
-    static std::vector<Task> taskList;
+    // A list, so tasks can launch apps while RunTasks walks it
+    static std::list<Task> taskList;
     static uint32_t currentTaskID = 0;
     constexpr size_t OS_RAM_SIZE = OS_RAM_SIZE_KB * 1024;
 
+    static bool runningTasks = false;
+    static std::vector<uint32_t> exitedApps; // Waiting for RunTasks to finish before their arenas go
+
     void Init() {
         // Initialize kernel state, hardware, etc.
         taskList.clear();
@@ -16,45 +22,176 @@ namespace Kernel {
     }
 
     void RegisterTask(std::function<void()> taskFunction, bool visible) {
-        Task newTask = {currentTaskID++, taskFunction, visible};
+        Task newTask = {currentTaskID++, taskFunction, visible, KERNEL_SYSTEM_APP_ID};
         taskList.push_back(newTask);
     }
 
+    static void reapExitedApps() {
+        for (uint32_t appID : exitedApps) {
+            taskList.remove_if([appID](const Task &task) { return task.appID == appID; });
+            ReleaseArena(appID);
+        }
+        exitedApps.clear();
+    }
+
     void RunTasks() {
         int tasksRunThisFrame = 0;
         const int tasksPerCycle = 3;
+        runningTasks = true;
         for (auto &task : taskList) {
             if (!task.visible) continue;
+            SetActiveApp(task.appID);
             task.function();
+            SetActiveApp(KERNEL_SYSTEM_APP_ID);
             tasksRunThisFrame++;
             if (tasksRunThisFrame >= tasksPerCycle) {
                 tasksRunThisFrame = 0;
             }
         }
+        runningTasks = false;
+        reapExitedApps();
     }
 
-    uint32_t* AllocateRAM(uint32_t size) {
-        // Prevent allocation if it would exceed OS_RAM_SIZE
-        static size_t used_ram = 0;
+    bool LaunchApp(uint32_t appID, std::function<void()> entry, uint32_t arenaSize) {
+        if (!entry || !CreateArena(appID, arenaSize)) return false;
+        taskList.push_back({currentTaskID++, entry, true, appID});
+        return true;
+    }
+
+    void ExitApp(uint32_t appID) {
+        if (appID == KERNEL_SYSTEM_APP_ID) return;
+        for (auto &task : taskList) {
+            if (task.appID == appID) task.visible = false;
+        }
+        exitedApps.push_back(appID);
+        if (!runningTasks) reapExitedApps();
+    }
+
+    static Arena arenas[KERNEL_MAX_ARENAS];
+
+    // System allocations are chained through a header, so only blocks handed out here are ever freed
+    struct SystemBlock {
+        SystemBlock *next;
+        uint32_t size; // Header included, as charged to used_ram
+    };
+    constexpr size_t BLOCK_HEADER = (sizeof(SystemBlock) + 7) & ~(size_t)7;
+    static SystemBlock *systemBlocks = nullptr;
+    static uint32_t activeApp = KERNEL_SYSTEM_APP_ID;
+    static size_t used_ram = 0; // Bytes reserved by arenas plus system allocations
+
+    static Arena *findArena(uint32_t appID) {
+        for (auto &arena : arenas) {
+            if (arena.inUse && arena.appID == appID) return &arena;
+        }
+        return nullptr;
+    }
+
+    bool CreateArena(uint32_t appID, uint32_t size) {
+        if (appID == KERNEL_SYSTEM_APP_ID || findArena(appID)) return false;
+        size = (size + 3) & ~3U; // Keep the arena word aligned
         if (used_ram + size > OS_RAM_SIZE) {
-            std::cerr << "[Kernel] RAM allocation failed: not enough memory (requested " << size << ", available " << (OS_RAM_SIZE - used_ram) << ")\n";
-            return nullptr;
+            std::cerr << "[Kernel] Arena for app " << appID << " failed: not enough memory (requested " << size << ", available " << (OS_RAM_SIZE - used_ram) << ")\n";
+            return false;
         }
-        uint32_t* pointer = new (std::nothrow) uint32_t[size / sizeof(uint32_t)];
-        if (pointer) {
+        for (auto &arena : arenas) {
+            if (arena.inUse) continue;
+            arena.base = new (std::nothrow) uint8_t[size];
+            if (!arena.base) return false;
+            arena.appID = appID;
+            arena.size = size;
+            arena.used = 0;
+            arena.lastAlloc = 0;
+            arena.highWater = 0;
+            arena.inUse = true;
             used_ram += size;
+            return true;
         }
-        return pointer;
+        std::cerr << "[Kernel] Arena for app " << appID << " failed: all " << KERNEL_MAX_ARENAS << " arenas in use\n";
+        return false;
+    }
+
+    void ReleaseArena(uint32_t appID) {
+        Arena *arena = findArena(appID);
+        if (!arena) return;
+        delete[] arena->base;
+        used_ram -= arena->size;
+        arena->base = nullptr;
+        arena->inUse = false;
+        if (activeApp == appID) activeApp = KERNEL_SYSTEM_APP_ID;
+    }
+
+    void SetActiveApp(uint32_t appID) {
+        activeApp = appID;
+    }
+
+    const Arena *GetArena(uint32_t appID) {
+        return findArena(appID);
+    }
+
+    uint32_t GetUsedRAM() {
+        return used_ram;
+    }
+
+    uint32_t* AllocateRAM(uint32_t size) {
+        size = (size + 3) & ~3U;
+
+        // App allocations are a bump of the arena pointer
+        if (activeApp != KERNEL_SYSTEM_APP_ID) {
+            Arena *arena = findArena(activeApp);
+            if (!arena || arena->used + size > arena->size) {
+                std::cerr << "[Kernel] RAM allocation failed: arena of app " << activeApp << " exhausted (requested " << size << ")\n";
+                return nullptr;
+            }
+            arena->lastAlloc = arena->used;
+            arena->used += size;
+            if (arena->used > arena->highWater) arena->highWater = arena->used;
+            return (uint32_t*)(arena->base + arena->lastAlloc);
+        }
+        return AllocateSystemRAM(size);
+    }
+
+    uint32_t* AllocateSystemRAM(uint32_t size) {
+        size = (size + 3) & ~3U;
+
+        // System allocations come from the heap, behind a header that registers them
+        if (used_ram + size + BLOCK_HEADER > OS_RAM_SIZE) {
+            std::cerr << "[Kernel] RAM allocation failed: not enough memory (requested " << size << ", available " << (OS_RAM_SIZE - used_ram) << ")\n";
+            return nullptr;
+        }
+        uint8_t* raw = new (std::nothrow) uint8_t[BLOCK_HEADER + size];
+        if (!raw) return nullptr;
+        SystemBlock* block = (SystemBlock*)raw;
+        block->size = BLOCK_HEADER + size;
+        block->next = systemBlocks;
+        systemBlocks = block;
+        used_ram += block->size;
+        return (uint32_t*)(raw + BLOCK_HEADER);
     }
 
     bool DeallocateRAM(uint32_t* pointer) {
-        if (pointer) {
-            // For simplicity, assume all allocations are the same size (not tracked per pointer)
-            // In a real OS, you'd track allocation sizes per pointer
-            delete[] pointer;
-            // used_ram -= size; // Not decremented here due to lack of size tracking
+        if (!pointer) return false;
+
+        for (auto &arena : arenas) {
+            if (!arena.inUse) continue;
+            uint8_t *p = (uint8_t*)pointer;
+            if (p < arena.base || p >= arena.base + arena.size) continue;
+            // Only the most recent allocation can be popped; the rest goes back with ReleaseArena
+            if (p == arena.base + arena.lastAlloc && arena.lastAlloc < arena.used) {
+                arena.used = arena.lastAlloc;
+            }
+            return true;
+        }
+
+        // Anything else must be a registered system block; stale arena pointers and foreign ones are refused
+        for (SystemBlock **link = &systemBlocks; *link; link = &(*link)->next) {
+            SystemBlock *block = *link;
+            if ((uint8_t*)block + BLOCK_HEADER != (uint8_t*)pointer) continue;
+            *link = block->next;
+            used_ram -= block->size;
+            delete[] (uint8_t*)block;
             return true;
         }
+        std::cerr << "[Kernel] DeallocateRAM: " << pointer << " was not allocated here\n";
         return false;
     }
 
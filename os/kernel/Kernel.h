@@ -5,17 +5,83 @@
 #include <vector>
 #include <functional>
 
+#define KERNEL_MAX_ARENAS 8    // Apps that may hold an arena at the same time
+#define KERNEL_SYSTEM_APP_ID 0 // appID reserved for the OS (see PIL::_ReserveSystemAppID)
+#define KERNEL_DEFAULT_ARENA_BYTES (16 * 1024) // Arena of an app launched without a size
+
 namespace Kernel {
     struct Task {
         uint32_t id;
         std::function<void()> function;
         bool visible;
+        uint32_t appID; // Owner; its arena serves AllocateRAM while the task runs
+    };
+
+    // Per-app memory arena, carved from the OS_RAM_SIZE_KB budget
+    struct Arena {
+        uint32_t appID;
+        uint8_t *base;      // Start of the arena block
+        uint32_t size;      // Bytes reserved for the app
+        uint32_t used;      // Bump pointer offset
+        uint32_t lastAlloc; // Offset of the most recent allocation, so it can be freed LIFO
+        uint32_t highWater; // Largest `used` seen since the arena was created
+        bool inUse;
     };
 
     void Init();
     void RegisterTask(std::function<void()> taskFunction, bool visible = true);
     void RunTasks();
+
+    /**
+     * Start an app: give it an arena of `arenaSize` bytes and run `entry` as its task, with the
+     * arena active. Returns false if the app is already running or the arena can't be reserved.
+     */
+    bool LaunchApp(uint32_t appID, std::function<void()> entry, uint32_t arenaSize = KERNEL_DEFAULT_ARENA_BYTES);
+
+    /**
+     * Stop an app: drop its tasks and release its arena. Called from the app's own task, the
+     * arena stays until the task returns.
+     */
+    void ExitApp(uint32_t appID);
+
+    /**
+     * Reserve `size` bytes of the OS RAM budget as an arena for `appID`.
+     * Returns false if the app already has an arena or the budget is exhausted.
+     */
+    bool CreateArena(uint32_t appID, uint32_t size);
+
+    /**
+     * Release the whole arena of `appID` in one go (call on app exit).
+     */
+    void ReleaseArena(uint32_t appID);
+
+    /**
+     * Route AllocateRAM to the arena of `appID`. KERNEL_SYSTEM_APP_ID allocates from the shared heap.
+     */
+    void SetActiveApp(uint32_t appID);
+
+    /**
+     * Returns the arena of `appID`, or nullptr if it has none.
+     */
+    const Arena *GetArena(uint32_t appID);
+
+    /**
+     * Bytes of the OS RAM budget currently reserved by arenas and system allocations.
+     */
+    uint32_t GetUsedRAM();
+
     uint32_t* AllocateRAM(uint32_t size);
+
+    /**
+     * Allocate from the shared heap whichever app is active, for OS state that outlives the
+     * app that asked for it. Free with DeallocateRAM.
+     */
+    uint32_t* AllocateSystemRAM(uint32_t size);
+
+    /**
+     * Free a block from AllocateRAM. Returns false, touching nothing, for pointers that are
+     * neither in a live arena nor a system block.
+     */
     bool DeallocateRAM(uint32_t* pointer);
     void TriggerGC();
     // Add more kernel services as needed
@@ -0,0 +1,436 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "./declaration/threading.h"
+#include "./declaration/OSconfig.h"
+#include "CodalFiber.h"
+#include "EventModel.h"
+#include "Timer.h"
+
+using namespace codal;
+
+// Thread pool
+static Thread threadPool[MAX_THREADS];
+static uint8_t currentThread = THREAD_NONE; // Thread currently holding the CPU
+static uint8_t threadCount = 0;             // Total number of threads
+
+// Each thread parks on its gate until the scheduler dispatches it
+static FiberLock *threadGate[MAX_THREADS];
+
+// Run queue: one bit per non-empty level, and one bit per ready thread within each level
+static uint32_t readyLevels = 0;
+static uint8_t levelThreads[THREAD_PRIORITY_LEVELS];
+
+// Preemption state, written from the timer tick and unblockThread
+static volatile bool reschedulePending = false;
+static volatile uint8_t sliceTicks = 0;
+static bool tickStarted = false;
+
+// Idle accounting for the PM governor: time with no thread holding the CPU
+static uint64_t idleSince = 0;
+static uint64_t idleTotalUs = 0;
+
+static inline uint8_t levelOf(uint8_t priority)
+{
+    return priority >> THREAD_PRIORITY_SHIFT;
+}
+
+static void readyInsert(uint8_t id)
+{
+    uint8_t level = levelOf(threadPool[id].priority);
+    levelThreads[level] |= 1 << id;
+    readyLevels |= 1UL << level;
+}
+
+static void readyRemove(uint8_t id)
+{
+    uint8_t level = levelOf(threadPool[id].priority);
+    levelThreads[level] &= ~(1 << id);
+    if (levelThreads[level] == 0)
+    {
+        readyLevels &= ~(1UL << level);
+    }
+}
+
+// Pick the highest priority ready thread, round-robin after `after` within its level
+static uint8_t pickNext(uint8_t after)
+{
+    if (readyLevels == 0)
+    {
+        return THREAD_NONE;
+    }
+
+    uint8_t level = 31 - __builtin_clz(readyLevels);
+    uint32_t mask = levelThreads[level];
+
+    if (after != THREAD_NONE)
+    {
+        uint32_t later = mask & ~((2UL << after) - 1);
+        if (later)
+        {
+            return __builtin_ctz(later);
+        }
+    }
+    return __builtin_ctz(mask);
+}
+
+// Does any ready thread outrank the running one?
+static bool outranksCurrent(uint8_t id)
+{
+    return currentThread == THREAD_NONE || levelOf(threadPool[id].priority) > levelOf(threadPool[currentThread].priority);
+}
+
+// Move the CPU token to `next` and wake its fiber
+static void handOff(uint8_t next)
+{
+    if ((currentThread == THREAD_NONE) != (next == THREAD_NONE))
+    {
+        uint64_t now = system_timer_current_time_us();
+        if (next == THREAD_NONE)
+        {
+            idleSince = now;
+        }
+        else
+        {
+            idleTotalUs += now - idleSince;
+        }
+    }
+    currentThread = next;
+    sliceTicks = 0;
+    reschedulePending = false;
+    if (next != THREAD_NONE)
+    {
+        threadGate[next]->notify();
+    }
+}
+
+// Is the calling fiber the thread that holds the CPU?
+static bool callerIsCurrent()
+{
+    return currentThread != THREAD_NONE && threadPool[currentThread].fiber == codal::currentFiber;
+}
+
+// Scheduling point for the running thread; returns true if the CPU was handed to another thread
+static bool dispatchFrom(uint8_t self)
+{
+    if (!reschedulePending && !threadPool[self].isBlocked)
+    {
+        return false;
+    }
+
+    uint8_t next = pickNext(self);
+    if (next == self)
+    {
+        sliceTicks = 0;
+        reschedulePending = false;
+        return false;
+    }
+
+    handOff(next);
+    return true;
+}
+
+// Change a thread's effective priority, keeping the run queue consistent
+static void reprioritise(uint8_t id, uint8_t priority)
+{
+    Thread &t = threadPool[id];
+    bool ready = !t.isBlocked && (levelThreads[levelOf(t.priority)] & (1 << id));
+
+    if (ready)
+    {
+        readyRemove(id);
+    }
+    t.priority = priority;
+    if (ready)
+    {
+        readyInsert(id);
+        if (id != currentThread && outranksCurrent(id))
+        {
+            reschedulePending = true;
+        }
+    }
+
+    // A running thread that dropped below a ready one should give way
+    if (id == currentThread && readyLevels && 31 - __builtin_clz(readyLevels) > levelOf(priority))
+    {
+        reschedulePending = true;
+    }
+}
+
+// System timer tick: account the running thread's timeslice
+static void onTick(Event)
+{
+    if (currentThread == THREAD_NONE)
+    {
+        return;
+    }
+
+    if (++sliceTicks >= THREAD_TIMESLICE_TICKS)
+    {
+        // Only worth switching if a peer of the same level is waiting
+        uint8_t level = levelOf(threadPool[currentThread].priority);
+        if (levelThreads[level] & ~(1 << currentThread))
+        {
+            reschedulePending = true;
+        }
+        sliceTicks = 0;
+    }
+}
+
+static void startTick()
+{
+    if (tickStarted || !EventModel::defaultEventBus)
+    {
+        return;
+    }
+    EventModel::defaultEventBus->listen(DEVICE_ID_OS_THREADING, THREAD_EVT_TICK, onTick, MESSAGE_BUS_LISTENER_IMMEDIATE);
+    system_timer_event_every_us(THREAD_TIMESLICE_US, DEVICE_ID_OS_THREADING, THREAD_EVT_TICK);
+    tickStarted = true;
+}
+
+// Fiber body shared by all threads
+static void threadMain(void *param)
+{
+    Thread *t = (Thread *)param;
+
+    while (true)
+    {
+        threadGate[t->id]->wait(); // Wait until dispatched
+
+        do
+        {
+            t->task();
+            schedule(); // Fibers outside the pool (frame pacer, input, display completions) run between task runs
+        } while (!dispatchFrom(t->id));
+    }
+}
+
+// Create a new thread with a specified priority
+bool createThread(void (*task)(void), uint8_t priority)
+{
+    if (task == NULL)
+    { // Ensure task is valid
+        return false;
+    }
+    if (threadCount >= MAX_THREADS)
+    { // Thread pool is full
+        return false;
+    }
+    if (priority > MAX_PRIORITY)
+    { // Enforce priority ceiling for non-system tasks
+        return false;
+    }
+
+    uint8_t id = threadCount;
+    threadGate[id] = new FiberLock(0, FiberLockMode::SEMAPHORE);
+
+    threadPool[id].id = id;
+    threadPool[id].task = task;
+    threadPool[id].isBlocked = false;
+    threadPool[id].inMutex = false;
+    threadPool[id].priority = priority; // Assign priority
+    threadPool[id].basePriority = priority;
+    threadPool[id].fiber = create_fiber(threadMain, &threadPool[id]);
+    if (threadPool[id].fiber == NULL)
+    {
+        delete threadGate[id];
+        threadGate[id] = NULL;
+        return false;
+    }
+    threadCount++;
+
+    startTick();
+    readyInsert(id);
+    if (outranksCurrent(id))
+    {
+        reschedulePending = true;
+    }
+    return true;
+}
+
+// Set priority for an existing thread
+bool setThreadPriority(uint8_t id, uint8_t priority)
+{
+    if (id >= threadCount || priority > MAX_PRIORITY)
+    {
+        return false; // Ensure thread ID and priority are valid
+    }
+
+    // Keep an inherited boost until the mutex holding it is released
+    bool boosted = threadPool[id].priority > threadPool[id].basePriority;
+    threadPool[id].basePriority = priority;
+    if (!boosted || priority > threadPool[id].priority)
+    {
+        reprioritise(id, priority);
+    }
+    return true;
+}
+
+// Switch to the next thread (O(1) priority bitmap, round-robin within a level)
+bool switchThread()
+{
+    if (threadCount == 0)
+    { // No threads to switch to
+        return false;
+    }
+
+    if (callerIsCurrent())
+    {
+        // Voluntary yield from the running thread
+        uint8_t self = currentThread;
+        reschedulePending = true;
+        if (dispatchFrom(self))
+        {
+            threadGate[self]->wait();
+        }
+        return true;
+    }
+
+    if (currentThread == THREAD_NONE)
+    {
+        uint8_t next = pickNext(THREAD_NONE);
+        if (next == THREAD_NONE)
+        {
+            return false; // Every thread is blocked
+        }
+        handOff(next);
+    }
+
+    // Let the dispatched thread run
+    schedule();
+    return true;
+}
+
+// Preemption point inside a long running task
+bool yieldThread()
+{
+    if (!callerIsCurrent() || !reschedulePending)
+    {
+        return false;
+    }
+
+    uint8_t self = currentThread;
+    if (!dispatchFrom(self))
+    {
+        return false;
+    }
+    threadGate[self]->wait();
+    return true;
+}
+
+// Block the current thread
+bool blockCurrentThread()
+{
+    if (!callerIsCurrent() || threadPool[currentThread].basePriority >= MAX_PRIORITY)
+    {
+        return false;
+    }
+
+    uint8_t self = currentThread;
+    threadPool[self].isBlocked = true;
+    readyRemove(self);
+    handOff(pickNext(self));
+
+    threadGate[self]->wait(); // Returns once unblocked and dispatched again
+    return true;
+}
+
+// Unblock a specific thread
+bool unblockThread(uint8_t id)
+{
+    if (id >= threadCount)
+    { // Validate thread ID
+        return false;
+    }
+    if (threadPool[id].inMutex)
+    { // Dispatching it now would run it while it still waits on the lock
+        return false;
+    }
+    if (!threadPool[id].isBlocked)
+    {
+        return true;
+    }
+
+    threadPool[id].isBlocked = false;
+    readyInsert(id);
+
+    if (currentThread == THREAD_NONE)
+    {
+        handOff(id); // CPU was idle, dispatch straight away
+    }
+    else if (outranksCurrent(id))
+    {
+        reschedulePending = true; // Preempt at the running thread's next scheduling point
+    }
+    return true;
+}
+
+void ThreadMutex::wait()
+{
+    if (!callerIsCurrent())
+    {
+        // Not an ARCADEOS thread, behave like a plain FiberLock
+        lock.wait();
+        owner = THREAD_FOREIGN;
+        return;
+    }
+
+    uint8_t self = currentThread;
+    if (owner == THREAD_NONE)
+    {
+        lock.wait(); // Free, so this won't block
+        owner = self;
+        return;
+    }
+
+    // Priority inheritance: the holder runs at least at our priority until it unlocks
+    if (owner != THREAD_FOREIGN && threadPool[owner].priority < threadPool[self].priority)
+    {
+        reprioritise(owner, threadPool[self].priority);
+    }
+
+    // Give up the CPU while we wait on the lock
+    threadPool[self].isBlocked = true;
+    threadPool[self].inMutex = true;
+    readyRemove(self);
+    handOff(pickNext(self));
+    lock.wait();
+
+    // Woken by notify(): become ready again and wait for our turn
+    owner = self;
+    threadPool[self].inMutex = false;
+    threadPool[self].isBlocked = false;
+    readyInsert(self);
+    if (currentThread == THREAD_NONE)
+    {
+        handOff(self);
+    }
+    else if (outranksCurrent(self))
+    {
+        reschedulePending = true;
+    }
+    threadGate[self]->wait();
+}
+
+void ThreadMutex::notify()
+{
+    uint8_t holder = owner;
+    // With fibers queued, notify() hands the lock straight to one of them, so it stays taken until that one runs
+    owner = lock.getWaitCount() > 0 ? THREAD_FOREIGN : THREAD_NONE;
+
+    if (holder < MAX_THREADS && threadPool[holder].priority != threadPool[holder].basePriority)
+    {
+        reprioritise(holder, threadPool[holder].basePriority);
+    }
+
+    lock.notify();
+}
+
+// Total time the CPU had no thread to run, including the current idle stretch
+uint64_t threadIdleTimeUs()
+{
+    if (currentThread == THREAD_NONE)
+    {
+        return idleTotalUs + (system_timer_current_time_us() - idleSince);
+    }
+    return idleTotalUs;
+}
@@ -0,0 +1,189 @@
+#include "asset.h"
+#include <cstring>
+
+namespace screen
+{
+    // Flash reads of any alignment; the M4 and the host are both little endian
+    static uint16_t read16(const uint8_t *p)
+    {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint32_t read32(const uint8_t *p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    // Length of the run starting at `code`, moving `code` past it
+    static int runLength(const uint8_t *&code, uint8_t tag)
+    {
+        int n = (tag >> 4) & 7;
+        return n < 7 ? n + 2 : *code++ + ASSET_RUN_SHORT_MAX + 1;
+    }
+
+    // Rows [y0, y1) of a framebuffer column in one colour
+    static void fillRows(uint8_t *col, int y0, int y1, uint8_t color)
+    {
+        if (y0 & 1)
+        {
+            col[y0 >> 1] = (col[y0 >> 1] & 0x0F) | (color << 4);
+            y0++;
+        }
+        if (y0 + 1 < y1)
+        {
+            memset(col + (y0 >> 1), color * 0x11, (y1 - y0) >> 1);
+            y0 += (y1 - y0) & ~1;
+        }
+        if (y0 < y1)
+        {
+            col[y0 >> 1] = (col[y0 >> 1] & 0xF0) | color;
+        }
+    }
+
+    // Rows [y0, y1) of a framebuffer column from packed pixels, starting at pixel `from` of `src`
+    static void copyRows(uint8_t *col, int y0, int y1, const uint8_t *src, int from, bool transparent)
+    {
+        if (!transparent && ((y0 ^ from) & 1) == 0)
+        {
+            // Same nibble order on both sides: whole bytes copy across
+            if (y0 & 1)
+            {
+                col[y0 >> 1] = (col[y0 >> 1] & 0x0F) | (src[from >> 1] & 0xF0);
+                y0++, from++;
+            }
+            if (y0 + 1 < y1)
+            {
+                int bytes = (y1 - y0) >> 1;
+                memcpy(col + (y0 >> 1), src + (from >> 1), bytes);
+                y0 += bytes * 2, from += bytes * 2;
+            }
+        }
+        for (; y0 < y1; y0++, from++)
+        {
+            uint8_t color = (src[from >> 1] >> ((from & 1) * 4)) & 0x0F;
+            if (transparent && color == 0)
+            {
+                continue;
+            }
+            uint8_t *p = col + (y0 >> 1);
+            *p = (y0 & 1) ? (*p & 0x0F) | (color << 4) : (*p & 0xF0) | color;
+        }
+    }
+
+    bool assetInfo(const uint8_t *asset, AssetInfo &info)
+    {
+        if (memcmp(asset, ASSET_MAGIC, 4) != 0)
+        {
+            return false;
+        }
+        info.width = read16(asset + 4);
+        info.height = read16(asset + 6);
+        info.size = read32(asset + ASSET_HEADER_BYTES + info.width * 4);
+        return true;
+    }
+
+    bool validateAsset(const uint8_t *asset, uint32_t length)
+    {
+        if (length < ASSET_HEADER_BYTES || memcmp(asset, ASSET_MAGIC, 4) != 0)
+        {
+            return false;
+        }
+        uint32_t codes = ASSET_HEADER_BYTES + (read16(asset + 4) + 1) * 4;
+        AssetInfo info;
+        if (length < codes || !assetInfo(asset, info) || info.size != length || read32(asset + ASSET_HEADER_BYTES) != codes)
+        {
+            return false;
+        }
+        for (int x = 0; x < info.width; x++)
+        {
+            uint32_t start = read32(asset + ASSET_HEADER_BYTES + x * 4);
+            uint32_t end = read32(asset + ASSET_HEADER_BYTES + (x + 1) * 4);
+            if (end < start || end > length)
+            {
+                return false;
+            }
+            const uint8_t *code = asset + start, *stop = asset + end;
+            int rows = 0;
+            while (rows < info.height)
+            {
+                if (code >= stop)
+                {
+                    return false;
+                }
+                uint8_t tag = *code++;
+                if (tag & 0x80)
+                {
+                    if (((tag >> 4) & 7) == 7 && code >= stop)
+                    {
+                        return false;
+                    }
+                    rows += runLength(code, tag);
+                }
+                else
+                {
+                    int count = (tag & 0x7F) + 1;
+                    code += (count + 1) >> 1;
+                    rows += count;
+                }
+            }
+            if (rows != info.height || code != stop)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool drawAsset(Image &target, const uint8_t *asset, int x, int y, bool transparent)
+    {
+        AssetInfo info;
+        if (!assetInfo(asset, info))
+        {
+            return false;
+        }
+        int x0 = std::max(x, 0), x1 = std::min(x + info.width, target.getWidth());
+        int y0 = std::max(y, 0), y1 = std::min(y + info.height, target.getHeight());
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return true;
+        }
+        target.markDirty(x0, y0, x1, y1);
+
+        for (int i = x0; i < x1; i++)
+        {
+            const uint8_t *code = asset + read32(asset + ASSET_HEADER_BYTES + (i - x) * 4);
+            uint8_t *col = target.bytes() + i * target.stride();
+            // Walk the codes above the top edge, draw down to the bottom one
+            for (int row = y; row < y1;)
+            {
+                uint8_t tag = *code++;
+                if (tag & 0x80)
+                {
+                    int count = runLength(code, tag);
+                    int a = std::max(row, y0), b = std::min(row + count, y1);
+                    if (a < b && !(transparent && (tag & 0x0F) == 0))
+                    {
+                        fillRows(col, a, b, tag & 0x0F);
+                    }
+                    row += count;
+                }
+                else
+                {
+                    int count = (tag & 0x7F) + 1;
+                    int a = std::max(row, y0), b = std::min(row + count, y1);
+                    if (a < b)
+                    {
+                        copyRows(col, a, b, code, a - row, transparent);
+                    }
+                    code += (count + 1) >> 1;
+                    row += count;
+                }
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef ASSET_H
+#define ASSET_H
+
+#include <cstdint>
+#include "image.d.cpp"
+
+/*
+ * Packed image assets ("RLE4"), made offline by tools/pack_asset.py. All fields little endian:
+ *
+ *   0   char[4]   "RLE4"
+ *   4   uint16    width
+ *   6   uint16    height
+ *   8   uint32    offsets[width + 1]: where each column's codes start, from the start of the asset;
+ *                 the last one is the size of the asset
+ *   ..  codes, one column after another, top to bottom, covering exactly `height` pixels each
+ *
+ * Columns rather than rows, as that is how the framebuffer is laid out: a clipped draw jumps
+ * straight to its first visible column and stops each column at the bottom edge. Codes:
+ *
+ *   0LLLLLLL           L + 1 literal pixels follow, two per byte, the first in the low nibble
+ *   1NNNCCCC           N + 2 pixels of colour C, N < 7
+ *   1111CCCC LLLLLLLL  L + 9 pixels of colour C
+ */
+#define ASSET_MAGIC "RLE4"
+#define ASSET_HEADER_BYTES 8
+#define ASSET_LITERAL_MAX 128
+#define ASSET_RUN_SHORT_MAX 8 // Longest run in a single byte
+#define ASSET_RUN_MAX 264
+
+namespace screen
+{
+    struct AssetInfo
+    {
+        uint16_t width, height;
+        uint32_t size; // Bytes, header included
+    };
+
+    /**
+     * @brief Read an asset's header.
+     * @return `false` if `asset` doesn't start with ASSET_MAGIC.
+     */
+    bool assetInfo(const uint8_t *asset, AssetInfo &info);
+
+    /**
+     * @brief Check that `length` bytes hold a well formed asset: offsets in order and in range,
+     * and every column decoding to `height` pixels within its own bytes.
+     *
+     * drawAsset() trusts what it is given, so check assets that come from files once on load.
+     */
+    bool validateAsset(const uint8_t *asset, uint32_t length);
+
+    /**
+     * @brief Decode an asset straight into `target` at (x, y), clipped to it.
+     *
+     * Reads the asset in place, so it can be drawn from memory-mapped flash without a copy
+     * in RAM: only the visible columns are decoded, each down to the target's bottom edge.
+     * @param transparent Leave the target alone where the asset has colour 0.
+     * @return `false` if `asset` isn't an asset.
+     */
+    bool drawAsset(Image &target, const uint8_t *asset, int x, int y, bool transparent = false);
+}
+
+#endif // ASSET_H
@@ -0,0 +1,203 @@
+#include "collision.h"
+
+namespace screen
+{
+    CollisionMask::CollisionMask(const Image &image)
+    {
+        update(image);
+    }
+
+    void CollisionMask::update(const Image &image)
+    {
+        width = image.getWidth();
+        height = image.getHeight();
+        words = (height + 31) / 32;
+        image.collisionMask(bits);
+    }
+
+    // 32 rows of a mask column starting at row `row`; rows outside the column read as 0
+    static uint32_t rowWindow(const uint32_t *col, int words, int row)
+    {
+        int index = row >> 5; // Rounds down for rows above the column too
+        int shift = row & 31;
+        uint32_t low = index >= 0 && index < words ? col[index] : 0;
+        if (shift == 0)
+        {
+            return low;
+        }
+        uint32_t high = index + 1 >= 0 && index + 1 < words ? col[index + 1] : 0;
+        return (low >> shift) | (high << (32 - shift));
+    }
+
+    bool CollisionMask::overlaps(const CollisionMask &other, int x, int y) const
+    {
+        int x0 = std::max(x, 0), x1 = std::min(x + other.width, width);
+        int y0 = std::max(y, 0), y1 = std::min(y + other.height, height);
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return false;
+        }
+        // Rows past either mask read as clear bits, so whole words are ANDed without clipping
+        int w0 = y0 >> 5, w1 = (y1 - 1) >> 5;
+        for (int i = x0; i < x1; ++i)
+        {
+            const uint32_t *mine = bits.data() + i * words;
+            const uint32_t *theirs = other.bits.data() + (i - x) * other.words;
+            for (int k = w0; k <= w1; ++k)
+            {
+                if (mine[k] & rowWindow(theirs, other.words, k * 32 - y))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    CollisionGrid::CollisionGrid(int width, int height, int cellSize) : cellShift(0)
+    {
+        while ((1 << (cellShift + 1)) <= cellSize)
+        {
+            cellShift++;
+        }
+        columns = std::max((width + (1 << cellShift) - 1) >> cellShift, 1);
+        rows = std::max((height + (1 << cellShift) - 1) >> cellShift, 1);
+        cellStart.assign(columns * rows + 1, 0);
+    }
+
+    void CollisionGrid::clear()
+    {
+        boxes.clear();
+        cellBoxes.clear();
+        std::fill(cellStart.begin(), cellStart.end(), 0);
+    }
+
+    void CollisionGrid::insert(uint16_t id, int x, int y, int w, int h)
+    {
+        if (w > 0 && h > 0 && boxes.size() < 0xFFFF)
+        {
+            boxes.push_back({(int16_t)x, (int16_t)y, (int16_t)(x + w), (int16_t)(y + h), id});
+        }
+    }
+
+    // Cells a box touches, clamped to the grid
+    void CollisionGrid::cellRange(const Box &box, int &c0, int &r0, int &c1, int &r1) const
+    {
+        c0 = std::min(std::max(box.x0 >> cellShift, 0), columns - 1);
+        r0 = std::min(std::max(box.y0 >> cellShift, 0), rows - 1);
+        c1 = std::min(std::max((box.x1 - 1) >> cellShift, 0), columns - 1);
+        r1 = std::min(std::max((box.y1 - 1) >> cellShift, 0), rows - 1);
+    }
+
+    int CollisionGrid::cellOf(int x, int y) const
+    {
+        int c = std::min(std::max(x >> cellShift, 0), columns - 1);
+        int r = std::min(std::max(y >> cellShift, 0), rows - 1);
+        return r * columns + c;
+    }
+
+    void CollisionGrid::build()
+    {
+        // Count the boxes per cell, turn the counts into start offsets, then place the boxes
+        std::fill(cellStart.begin(), cellStart.end(), 0);
+        size_t total = 0;
+        for (const Box &box : boxes)
+        {
+            int c0, r0, c1, r1;
+            cellRange(box, c0, r0, c1, r1);
+            for (int r = r0; r <= r1; ++r)
+            {
+                for (int c = c0; c <= c1; ++c)
+                {
+                    cellStart[r * columns + c + 1]++;
+                }
+            }
+            total += (c1 - c0 + 1) * (r1 - r0 + 1);
+        }
+        for (size_t i = 1; i < cellStart.size(); ++i)
+        {
+            cellStart[i] += cellStart[i - 1];
+        }
+        cellBoxes.resize(total);
+
+        // Fill each cell from its start; `cellStart[cell]` walks up to the next cell's start, then gets moved back
+        for (size_t b = 0; b < boxes.size(); ++b)
+        {
+            int c0, r0, c1, r1;
+            cellRange(boxes[b], c0, r0, c1, r1);
+            for (int r = r0; r <= r1; ++r)
+            {
+                for (int c = c0; c <= c1; ++c)
+                {
+                    cellBoxes[cellStart[r * columns + c]++] = b;
+                }
+            }
+        }
+        for (size_t i = cellStart.size() - 1; i > 0; --i)
+        {
+            cellStart[i] = cellStart[i - 1];
+        }
+        cellStart[0] = 0;
+    }
+
+    int CollisionGrid::forEachPair(const std::function<void(uint16_t, uint16_t)> &hit) const
+    {
+        int pairs = 0;
+        for (int cell = 0; cell + 1 < (int)cellStart.size(); ++cell)
+        {
+            for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; ++i)
+            {
+                const Box &a = boxes[cellBoxes[i]];
+                for (uint32_t j = i + 1; j < cellStart[cell + 1]; ++j)
+                {
+                    const Box &b = boxes[cellBoxes[j]];
+                    if (a.x0 >= b.x1 || b.x0 >= a.x1 || a.y0 >= b.y1 || b.y0 >= a.y1)
+                    {
+                        continue;
+                    }
+                    // A pair sharing several cells is reported from the one holding the top left of their overlap
+                    if (cellOf(std::max(a.x0, b.x0), std::max(a.y0, b.y0)) != cell)
+                    {
+                        continue;
+                    }
+                    hit(a.id, b.id);
+                    pairs++;
+                }
+            }
+        }
+        return pairs;
+    }
+
+    int CollisionGrid::query(int x, int y, int w, int h, std::vector<uint16_t> &ids) const
+    {
+        ids.clear();
+        if (w <= 0 || h <= 0)
+        {
+            return 0;
+        }
+        Box area = {(int16_t)x, (int16_t)y, (int16_t)(x + w), (int16_t)(y + h), 0};
+        int c0, r0, c1, r1;
+        cellRange(area, c0, r0, c1, r1);
+        for (int r = r0; r <= r1; ++r)
+        {
+            for (int c = c0; c <= c1; ++c)
+            {
+                int cell = r * columns + c;
+                for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; ++i)
+                {
+                    const Box &b = boxes[cellBoxes[i]];
+                    if (area.x0 >= b.x1 || b.x0 >= area.x1 || area.y0 >= b.y1 || b.y0 >= area.y1)
+                    {
+                        continue;
+                    }
+                    // Same rule as pairs: count each box in the first queried cell it shares with the area
+                    if (cellOf(std::max(area.x0, b.x0), std::max(area.y0, b.y0)) == cell)
+                    {
+                        ids.push_back(b.id);
+                    }
+                }
+            }
+        }
+        return ids.size();
+    }
+}
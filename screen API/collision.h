@@ -0,0 +1,96 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include "image.d.cpp"
+
+#ifndef COLLISION_CELL_SIZE
+#define COLLISION_CELL_SIZE 32 // Grid cell size in pixels, about the size of a typical sprite
+#endif
+
+namespace screen
+{
+    /**
+     * @brief The non-zero pixels of an image, 1 bit per pixel.
+     *
+     * Columns of (height + 31) / 32 words, bit n for row n, so two masks are compared 32 rows
+     * at a time: a column of one ANDed with the other's shifted by the vertical offset.
+     * Build it once per image, and again with update() after drawing into the image.
+     */
+    class CollisionMask
+    {
+    private:
+        int width = 0, height = 0;
+        int words = 0; // Per column
+        std::vector<uint32_t> bits;
+
+    public:
+        explicit CollisionMask(const Image &image);
+
+        void update(const Image &image);
+        int getWidth() const { return width; }
+        int getHeight() const { return height; }
+        const uint32_t *data() const { return bits.data(); }
+
+        // Whether a set pixel of `other` placed at (x, y) relative to this mask lands on a set pixel of it
+        bool overlaps(const CollisionMask &other, int x, int y) const;
+    };
+
+    /**
+     * @brief Broad phase for many sprites: boxes are sorted into grid cells, and only boxes
+     * sharing a cell are tested against each other.
+     *
+     * Rebuilt every frame: clear(), insert() each box, build(), then query. Boxes off the
+     * grid are kept in its edge cells. Storage grows to the largest frame seen and is reused.
+     */
+    class CollisionGrid
+    {
+    private:
+        struct Box
+        {
+            int16_t x0, y0, x1, y1;
+            uint16_t id;
+        };
+
+        int cellShift;
+        int columns, rows;
+        std::vector<Box> boxes;
+        std::vector<uint32_t> cellStart; // Per cell, where its boxes start in `cellBoxes`; one past the end last
+        std::vector<uint16_t> cellBoxes; // Indices into `boxes`, cell by cell
+
+        void cellRange(const Box &box, int &c0, int &r0, int &c1, int &r1) const;
+        int cellOf(int x, int y) const;
+
+    public:
+        /**
+         * @param width Area covered, usually the screen or the tile map, in pixels.
+         * @param height
+         * @param cellSize A power of two.
+         */
+        CollisionGrid(int width, int height, int cellSize = COLLISION_CELL_SIZE);
+
+        void clear();
+
+        // Add a box for this frame; `id` is what the queries report it as
+        void insert(uint16_t id, int x, int y, int w, int h);
+
+        // Sort the boxes into cells; call after the inserts and before the queries
+        void build();
+
+        /**
+         * @brief Call `hit` once for every pair of overlapping boxes.
+         * @return Pairs reported.
+         */
+        int forEachPair(const std::function<void(uint16_t, uint16_t)> &hit) const;
+
+        /**
+         * @brief Collect the ids of the boxes overlapping an area, each once.
+         * @return How many were found.
+         */
+        int query(int x, int y, int w, int h, std::vector<uint16_t> &ids) const;
+    };
+}
+
+#endif // COLLISION_H
@@ -0,0 +1,305 @@
+#include "display.h"
+#include "frame.h"
+#include "OSconfig.h"
+#include "CodalFiber.h"
+#include "Event.h"
+#include "codal_target_hal.h"
+#include "Input.h" // Input-to-photon latency
+
+namespace screen
+{
+    // Where each header step starts in `header`: command bytes go with D/C low, their arguments high
+    static const uint8_t headerOffsets[DISPLAY_HEADER_STEPS + 1] = {0, 1, 5, 6, 10, 11};
+
+    Display::Display(codal::SPI &spi, codal::Pin &cs, codal::Pin &dc, int width, int height)
+        : spi(spi), cs(cs), dc(dc), width(width), height(height)
+    {
+        for (auto &chunk : chunks)
+        {
+            chunk.resize(std::max(DISPLAY_CHUNK_BYTES, height * DISPLAY_BYTES_PER_PIXEL));
+        }
+        memset(palette, 0, sizeof(palette));
+        cs.setDigitalValue(1);
+    }
+
+    void Display::setPalette(const uint8_t *rgb, int count)
+    {
+        for (int i = 0; i < count && i < DISPLAY_PALETTE_SIZE; ++i, rgb += 3)
+        {
+            uint16_t color = ((rgb[0] & 0xF8) << 8) | ((rgb[1] & 0xFC) << 3) | (rgb[2] >> 3);
+            palette[i][0] = color >> 8;
+            palette[i][1] = color & 0xFF;
+        }
+    }
+
+    void Display::setOffset(int column, int row)
+    {
+        columnOffset = column;
+        rowOffset = row;
+    }
+
+    // D/C low for the command byte, high for its parameters; the caller holds CS
+    void Display::command(uint8_t cmd, const uint8_t *data, uint32_t length)
+    {
+        dc.setDigitalValue(0);
+        spi.transfer(&cmd, 1, NULL, 0);
+        dc.setDigitalValue(1);
+        if (length)
+        {
+            spi.transfer(data, length, NULL, 0);
+        }
+    }
+
+    void Display::convertColumn(const Image &image, int x, int y0, int y1, uint8_t *out) const
+    {
+        const uint8_t *col = image.bytes() + x * image.stride();
+        int y = y0;
+        if (y & 1)
+        {
+            memcpy(out, palette[col[y >> 1] >> 4], DISPLAY_BYTES_PER_PIXEL);
+            out += DISPLAY_BYTES_PER_PIXEL;
+            ++y;
+        }
+        // Two pixels per byte
+        for (; y + 1 < y1; y += 2, out += 2 * DISPLAY_BYTES_PER_PIXEL)
+        {
+            uint8_t pair = col[y >> 1];
+            memcpy(out, palette[pair & 0x0F], DISPLAY_BYTES_PER_PIXEL);
+            memcpy(out + DISPLAY_BYTES_PER_PIXEL, palette[pair >> 4], DISPLAY_BYTES_PER_PIXEL);
+        }
+        if (y < y1)
+        {
+            memcpy(out, palette[col[y >> 1] & 0x0F], DISPLAY_BYTES_PER_PIXEL);
+        }
+    }
+
+    void Display::buildHeader(const DirtyRect &r)
+    {
+        uint16_t c0 = r.y0 + columnOffset, c1 = r.y1 - 1 + columnOffset;
+        uint16_t r0 = r.x0 + rowOffset, r1 = r.x1 - 1 + rowOffset;
+        const uint8_t bytes[DISPLAY_WINDOW_OVERHEAD] = {
+            DISPLAY_CMD_CASET, (uint8_t)(c0 >> 8), (uint8_t)c0, (uint8_t)(c1 >> 8), (uint8_t)c1,
+            DISPLAY_CMD_RASET, (uint8_t)(r0 >> 8), (uint8_t)r0, (uint8_t)(r1 >> 8), (uint8_t)r1,
+            DISPLAY_CMD_RAMWR};
+        memcpy(header, bytes, sizeof(header));
+    }
+
+    // Convert as many whole columns of the current window as fit; 0 once the window is done
+    uint32_t Display::fillChunk(uint8_t *out)
+    {
+        const DirtyRect &r = windows[windowIndex];
+        uint32_t columnBytes = (r.y1 - r.y0) * DISPLAY_BYTES_PER_PIXEL;
+        uint32_t used = 0;
+        for (; nextColumn < r.x1 && used + columnBytes <= chunks[0].size(); ++nextColumn)
+        {
+            convertColumn(*streaming, nextColumn, r.y0, r.y1, out + used);
+            used += columnBytes;
+        }
+        return used;
+    }
+
+    // Dirty areas to send, or the whole frame when that is no dearer
+    int Display::planWindows(Image &image, uint32_t &bytes)
+    {
+        int count = image.getDirtyCount();
+        uint32_t full = DISPLAY_WINDOW_OVERHEAD + image.getWidth() * image.getHeight() * DISPLAY_BYTES_PER_PIXEL;
+        bytes = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            windows[i] = image.getDirtyRect(i);
+            bytes += DISPLAY_WINDOW_OVERHEAD + windows[i].area() * DISPLAY_BYTES_PER_PIXEL;
+        }
+        if (bytes >= full)
+        {
+            windows[0] = {0, 0, (int16_t)std::min(image.getWidth(), width), (int16_t)std::min(image.getHeight(), height)};
+            bytes = DISPLAY_WINDOW_OVERHEAD + windows[0].area() * DISPLAY_BYTES_PER_PIXEL;
+            count = 1;
+        }
+        image.clearDirty();
+
+        if (count)
+        {
+            stats.frames++;
+            stats.windows += count;
+            stats.bytesSent += bytes;
+            stats.fullBytes += full;
+        }
+        return count;
+    }
+
+    uint32_t Display::sendWindow(const Image &image, const DirtyRect &r)
+    {
+        buildHeader(r);
+        cs.setDigitalValue(0);
+        command(header[0], header + 1, 4);
+        command(header[5], header + 6, 4);
+        command(header[10], NULL, 0);
+
+        // Whole image columns per transfer, as many as fit in the chunk
+        uint32_t columnBytes = (r.y1 - r.y0) * DISPLAY_BYTES_PER_PIXEL;
+        uint32_t used = 0;
+        for (int x = r.x0; x < r.x1; ++x)
+        {
+            if (used + columnBytes > chunks[0].size())
+            {
+                spi.transfer(chunks[0].data(), used, NULL, 0);
+                used = 0;
+            }
+            convertColumn(image, x, r.y0, r.y1, chunks[0].data() + used);
+            used += columnBytes;
+        }
+        if (used)
+        {
+            spi.transfer(chunks[0].data(), used, NULL, 0);
+        }
+        cs.setDigitalValue(1);
+        return DISPLAY_WINDOW_OVERHEAD + columnBytes * (r.x1 - r.x0);
+    }
+
+    uint32_t Display::push(Image &image)
+    {
+        waitIdle(); // The chunk buffers may still be in use
+        uint32_t bytes;
+        int count = planWindows(image, bytes);
+        for (int i = 0; i < count; ++i)
+        {
+            sendWindow(image, windows[i]);
+        }
+        if (count)
+        {
+            MarkDisplayTransferDone();
+        }
+        return bytes;
+    }
+
+    uint32_t Display::pushAll(Image &image)
+    {
+        image.markDirty(0, 0, image.getWidth(), image.getHeight());
+        return push(image);
+    }
+
+    bool Display::startPush(Image &image)
+    {
+        waitIdle();
+        uint32_t bytes;
+        windowCount = planWindows(image, bytes);
+        if (windowCount == 0)
+        {
+            return false;
+        }
+        streaming = &image;
+        windowIndex = 0;
+        headerStep = 0;
+        busy = true;
+        step();
+        return true;
+    }
+
+    void Display::onTransferDone(void *display)
+    {
+        ((Display *)display)->step();
+    }
+
+    // Start the next transfer of the chain. Runs from the SPI completion interrupt after the first
+    void Display::step()
+    {
+        while (windowIndex < windowCount)
+        {
+            if (headerStep < DISPLAY_HEADER_STEPS)
+            {
+                int s = headerStep++;
+                if (s == 0)
+                {
+                    buildHeader(windows[windowIndex]);
+                    nextColumn = windows[windowIndex].x0;
+                    cs.setDigitalValue(0);
+                }
+                dc.setDigitalValue(s & 1);
+                spi.startTransfer(header + headerOffsets[s], headerOffsets[s + 1] - headerOffsets[s], NULL, 0, onTransferDone, this);
+                if (s == DISPLAY_HEADER_STEPS - 1)
+                {
+                    // Convert the first chunk while RAMWR goes out
+                    readyChunk = 0;
+                    readyBytes = fillChunk(chunks[0].data());
+                }
+                return;
+            }
+            if (readyBytes)
+            {
+                if (headerStep == DISPLAY_HEADER_STEPS)
+                {
+                    dc.setDigitalValue(1);
+                    headerStep++; // D/C stays high for the rest of the window
+                }
+                spi.startTransfer(chunks[readyChunk].data(), readyBytes, NULL, 0, onTransferDone, this);
+                readyChunk ^= 1;
+                readyBytes = fillChunk(chunks[readyChunk].data()); // Overlaps the transfer just started
+                return;
+            }
+            cs.setDigitalValue(1);
+            windowIndex++;
+            headerStep = 0;
+        }
+
+        busy = false;
+        MarkDisplayTransferDone();
+        codal::Event(DEVICE_ID_OS_DISPLAY, DISPLAY_EVT_TRANSFER_DONE);
+    }
+
+    void Display::waitIdle()
+    {
+        while (true)
+        {
+            target_disable_irq();
+            if (!busy)
+            {
+                target_enable_irq();
+                return;
+            }
+            codal::fiber_wake_on_event(DEVICE_ID_OS_DISPLAY, DISPLAY_EVT_TRANSFER_DONE);
+            target_enable_irq();
+            codal::schedule();
+        }
+    }
+
+    DoubleBuffer::DoubleBuffer(Display &display, int width, int height)
+        : display(display), first(width, height), second(width, height), backBuffer(&first), frontBuffer(&second)
+    {
+    }
+
+    void DoubleBuffer::present()
+    {
+        Image &shown = *backBuffer, &next = *frontBuffer;
+
+        // `next` may still be streaming from the last present()
+        display.waitIdle();
+
+        DirtyRect changed[IMAGE_DIRTY_RECTS];
+        int count = shown.getDirtyCount();
+        for (int i = 0; i < count; ++i)
+        {
+            changed[i] = shown.getDirtyRect(i);
+        }
+        display.startPush(shown);
+
+        // Bring `next` up to the frame now on its way out; both only read `shown`, so this overlaps the DMA
+        for (int i = 0; i < count; ++i)
+        {
+            next.copyRect(shown, changed[i]);
+        }
+        next.clearDirty();
+
+        backBuffer = &next;
+        frontBuffer = &shown;
+    }
+
+    void setup_display(Display &display, Image &framebuffer)
+    {
+        setup_update([&display, &framebuffer]() { display.push(framebuffer); });
+    }
+
+    void setup_display(DoubleBuffer &buffers)
+    {
+        setup_update([&buffers]() { buffers.present(); });
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <cstdint>
+#include <vector>
+#include "codal-core/inc/driver-models/SPI.h"
+#include "Pin.h"
+#include "image.d.cpp"
+
+// MIPI DCS commands understood by the ST7735 / ILI9341 family
+#define DISPLAY_CMD_CASET 0x2A // Column address set
+#define DISPLAY_CMD_RASET 0x2B // Row address set
+#define DISPLAY_CMD_RAMWR 0x2C // Memory write
+
+#define DISPLAY_BYTES_PER_PIXEL 2  // RGB565
+#define DISPLAY_WINDOW_OVERHEAD 11 // Command and address bytes per window
+#define DISPLAY_HEADER_STEPS 5     // CASET, its address, RASET, its address, RAMWR
+#define DISPLAY_PALETTE_SIZE 16
+
+#ifndef DISPLAY_CHUNK_BYTES
+#define DISPLAY_CHUNK_BYTES 1024 // Pixels converted per SPI transfer
+#endif
+
+#define DISPLAY_EVT_TRANSFER_DONE 1 // Raised on DEVICE_ID_OS_DISPLAY when a startPush() finishes
+
+namespace screen
+{
+    struct DisplayStats
+    {
+        uint32_t frames;    // Pushes that sent anything
+        uint32_t windows;   // Address windows sent
+        uint64_t bytesSent; // Command and pixel bytes
+        uint64_t fullBytes; // What the same pushes would have cost as whole frames
+    };
+
+    /**
+     * @brief Panel driver that sends only the parts of the framebuffer that changed.
+     *
+     * The panel must be set up (MADCTL) to fill memory along its column address first, so the
+     * column-major framebuffer streams out as is: CASET spans image rows and RASET image columns.
+     */
+    class Display
+    {
+    private:
+        codal::SPI &spi;
+        codal::Pin &cs, &dc;
+        int width, height;
+        int columnOffset = 0, rowOffset = 0;
+        uint8_t palette[DISPLAY_PALETTE_SIZE][DISPLAY_BYTES_PER_PIXEL]; // RGB565, big endian
+        std::vector<uint8_t> chunks[2]; // Ping-pong: one streams while the other is converted
+        DisplayStats stats = {};
+
+        // State of the transfer chain started by startPush(), advanced from the SPI interrupt
+        volatile bool busy = false;
+        const Image *streaming = nullptr;
+        DirtyRect windows[IMAGE_DIRTY_RECTS];
+        int windowCount = 0, windowIndex = 0;
+        int headerStep = 0;
+        int nextColumn = 0;
+        uint8_t header[DISPLAY_WINDOW_OVERHEAD];
+        uint32_t readyBytes = 0;
+        uint8_t readyChunk = 0;
+
+        void command(uint8_t cmd, const uint8_t *data, uint32_t length);
+        void convertColumn(const Image &image, int x, int y0, int y1, uint8_t *out) const;
+        void buildHeader(const DirtyRect &r);
+        uint32_t fillChunk(uint8_t *out);
+        int planWindows(Image &image, uint32_t &bytes);
+        uint32_t sendWindow(const Image &image, const DirtyRect &r);
+        void step();
+        static void onTransferDone(void *display);
+
+    public:
+        Display(codal::SPI &spi, codal::Pin &cs, codal::Pin &dc, int width, int height);
+
+        /**
+         * @brief Set the colours of the 16 palette entries.
+         * @param rgb `count` RGB888 triplets, pxt's palette buffer format.
+         */
+        void setPalette(const uint8_t *rgb, int count);
+
+        // Where the visible area starts in panel memory, for panels with an offset
+        void setOffset(int column, int row);
+
+        /**
+         * @brief Send the areas of `image` changed since the last push, then clear them.
+         *
+         * When the windows would cost as much as the whole frame, the whole frame is sent instead.
+         * @return Bytes sent over SPI.
+         */
+        uint32_t push(Image &image);
+
+        // Send all of `image` as one window
+        uint32_t pushAll(Image &image);
+
+        /**
+         * @brief Like push(), but returns once the first DMA transfer is under way.
+         *
+         * The rest of the frame is chained from the SPI completion interrupt, converting the next
+         * chunk to RGB565 while the current one streams. `image` must not change until the transfer
+         * is done: wait with waitIdle() or listen for DISPLAY_EVT_TRANSFER_DONE.
+         * @return `false` if nothing had changed.
+         */
+        bool startPush(Image &image);
+
+        bool isBusy() const { return busy; }
+
+        // Block the calling fiber until the transfer started by startPush() is done
+        void waitIdle();
+
+        const DisplayStats &getStats() const { return stats; }
+    };
+
+    /**
+     * @brief Two framebuffers: one is drawn into while the other streams to the panel.
+     *
+     * After each present() the buffer handed out by back() already holds the frame just sent,
+     * so drawing only needs to touch what changes.
+     */
+    class DoubleBuffer
+    {
+    private:
+        Display &display;
+        Image first, second;
+        Image *backBuffer, *frontBuffer;
+
+    public:
+        DoubleBuffer(Display &display, int width, int height);
+
+        Image &back() { return *backBuffer; }
+
+        /**
+         * @brief Start sending the back buffer and swap.
+         *
+         * Waits only for the transfer before this one, so frame N+1 renders while frame N streams.
+         */
+        void present();
+    };
+
+    /**
+     * @brief Make screen::update push `framebuffer`'s changes to `display`.
+     */
+    void setup_display(Display &display, Image &framebuffer);
+
+    /**
+     * @brief Make screen::update present `buffers`; draw into `buffers.back()`.
+     */
+    void setup_display(DoubleBuffer &buffers);
+}
+
+#endif // DISPLAY_H
@@ -3,6 +3,14 @@
 #include <string>
 #include <vector>
 #include <cmath> // for floor
+#include <memory>
+#include <list>
+#include "frame.h"
+
+#ifndef TEXT_CACHE_BUDGET_BYTES
+#define TEXT_CACHE_BUDGET_BYTES 4096 // Default RAM for cached text strips
+#endif
+#define TEXT_CACHE_SEEN 32 // Strings remembered after one miss; only a repeat gets a strip
 
 // Placeholder for `TextEffectState`, which would be defined elsewhere
 struct TextEffectState
@@ -65,12 +73,30 @@ const Font font12 = {
     1   // Default multiplier
 };
 
+// Code point of the UTF-8 sequence at `text[i]`, advancing `i` past it
+static uint32_t nextCodePoint(const std::string &text, size_t &i)
+{
+    uint8_t c = text[i++];
+    int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    uint32_t cp = extra ? c & (0x3F >> extra) : c;
+    for (; extra && i < text.length() && (text[i] & 0xC0) == 0x80; --extra)
+    {
+        cp = (cp << 6) | (text[i++] & 0x3F);
+    }
+    return cp;
+}
+
 // Function to get font based on text
 const Font &getFontForText(const std::string &text)
 {
-    for (char c : text)
+    // font12 has no glyphs yet, so it's only worth picking once it has some
+    if (font12.data.empty())
+    {
+        return font5;
+    }
+    for (size_t i = 0; i < text.length();)
     {
-        if (static_cast<uint32_t>(c) > 0x2000)
+        if (nextCodePoint(text, i) > 0x2000)
         {
             return font12;
         }
@@ -83,7 +109,7 @@ Font scaledFont(const Font &f, uint8_t size)
 {
     if (screen::sleepmode)
     {
-        return f
+        return f;
     }
     if (size < 2)
     {
@@ -103,27 +129,300 @@ Font doubledFont(const Font &f)
     return scaledFont(f, 2);
 }
 
-// Function to print text centered
-bool imagePrintCenter(Image &img, const std::string &text, int y, int color = -1, const Font *font = nullptr)
+/**
+ * Every glyph of a font at one scale, expanded to the framebuffer's nibble layout so a character
+ * is one Image::drawMask call. Glyphs are found by code point through 256-entry pages.
+ */
+struct GlyphAtlas
 {
-    if (screen::sleepmode)
+    uint64_t key[4];                         // What the font is, see atlasKey()
+    int width, height;                       // Glyph cell in pixels, scale applied
+    int words;                               // Mask words per glyph column
+    std::vector<uint32_t> masks;             // width * words words per glyph
+    std::vector<std::vector<int16_t>> pages; // [cp >> 8][cp & 0xFF]: glyph number, -1 if missing
+
+    const uint32_t *glyph(uint32_t cp) const
     {
-        return
+        if ((cp >> 8) >= pages.size() || pages[cp >> 8].empty())
+        {
+            return nullptr;
+        }
+        int16_t g = pages[cp >> 8][cp & 0xFF];
+        return g < 0 ? nullptr : masks.data() + g * width * words;
     }
+};
 
-    if (!font)
+static std::vector<std::unique_ptr<GlyphAtlas>> atlases;
+
+// Fonts are values (scaledFont copies them), so an atlas is keyed by what the font is, not where it lives
+static void atlasKey(const Font &font, uint64_t key[4])
+{
+    key[0] = font.charWidth | font.charHeight << 8 | (font.multiplier ? font.multiplier : 1) << 16;
+    key[1] = font.data.size();
+    key[2] = font.data.empty() ? 0 : font.data.front();
+    key[3] = font.data.empty() ? 0 : font.data.back();
+}
+
+// The font data is pxt's byte format packed big endian into 64-bit words
+static uint8_t fontByte(const std::vector<uint64_t> &data, size_t i)
+{
+    return (data[i >> 3] >> (56 - 8 * (i & 7))) & 0xFF;
+}
+
+static std::unique_ptr<GlyphAtlas> buildAtlas(const Font &font)
+{
+    std::unique_ptr<GlyphAtlas> atlas(new GlyphAtlas());
+    int mult = font.multiplier ? font.multiplier : 1;
+    int dataW = font.charWidth / mult;
+    int dataH = font.charHeight / mult;
+    int byteHeight = (dataH + 7) >> 3;
+    int dataSize = 2 + byteHeight * dataW;
+    int glyphs = (int)(font.data.size() * sizeof(uint64_t) / dataSize);
+
+    atlasKey(font, atlas->key);
+    atlas->width = font.charWidth;
+    atlas->height = font.charHeight;
+    atlas->words = (font.charHeight + IMAGE_ROWS_PER_WORD - 1) / IMAGE_ROWS_PER_WORD;
+    atlas->masks.assign((size_t)glyphs * atlas->width * atlas->words, 0);
+
+    for (int g = 0; g < glyphs; ++g)
     {
-        font = &getFontForText(text);
+        size_t off = (size_t)g * dataSize;
+        uint32_t cp = fontByte(font.data, off) | fontByte(font.data, off + 1) << 8;
+        if ((cp >> 8) >= atlas->pages.size())
+        {
+            atlas->pages.resize((cp >> 8) + 1);
+        }
+        std::vector<int16_t> &page = atlas->pages[cp >> 8];
+        if (page.empty())
+        {
+            page.assign(256, -1);
+        }
+        page[cp & 0xFF] = g;
+
+        uint32_t *mask = atlas->masks.data() + g * atlas->width * atlas->words;
+        for (int i = 0; i < dataW; ++i)
+        {
+            for (int j = 0; j < dataH; ++j)
+            {
+                if (!((fontByte(font.data, off + 2 + i * byteHeight + (j >> 3)) >> (j & 7)) & 1))
+                {
+                    continue;
+                }
+                // Each font pixel becomes a mult x mult block
+                for (int sx = 0; sx < mult; ++sx)
+                {
+                    uint32_t *col = mask + (i * mult + sx) * atlas->words;
+                    for (int row = j * mult; row < (j + 1) * mult; ++row)
+                    {
+                        col[row >> 3] |= 0xFu << ((row & 7) * 4);
+                    }
+                }
+            }
+        }
     }
+    return atlas;
+}
 
-    int w = text.length() * font->charWidth;
-    int x = std::floor((img.getWidth() - w) / 2.0);
+// Atlas for `font`, built on first use
+const GlyphAtlas &glyphAtlas(const Font &font)
+{
+    uint64_t key[4];
+    atlasKey(font, key);
+    for (const auto &atlas : atlases)
+    {
+        if (memcmp(atlas->key, key, sizeof(key)) == 0)
+        {
+            return *atlas;
+        }
+    }
+    atlases.push_back(buildAtlas(font));
+    return *atlases.back();
+}
 
-    // Call the `imagePrint` function
-    imagePrint(img, text, x, y, color, font);
+// Free every atlas, e.g. when switching to a game that uses other fonts or scales
+void releaseGlyphAtlases()
+{
+    atlases.clear();
+}
 
-    // Indicate success
-    return true;
+// Counters for sizing the text cache
+struct TextCacheStats
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t skipped; // Misses drawn straight from the atlas, the string's first sighting
+    uint32_t evictions;
+    uint32_t entries;
+    uint32_t bytes;  // In use, strips and strings
+    uint32_t budget; // Most it may use
+};
+
+// A string rendered once into a 1 bit per pixel strip, column-major like the framebuffer
+struct CachedText
+{
+    std::string text;
+    uint64_t font[4]; // atlasKey() of the font, which covers the scale
+    uint32_t hash;
+    int width, height;
+    std::vector<uint32_t> bits; // (height + 31) / 32 words per column
+
+    uint32_t bytes() const { return sizeof(CachedText) + text.capacity() + bits.size() * sizeof(uint32_t); }
+};
+
+// Most recently used first
+static std::list<CachedText> textCache;
+static TextCacheStats textCacheStats = {0, 0, 0, 0, 0, 0, TEXT_CACHE_BUDGET_BYTES};
+
+// Tags of strings missed once, oldest overwritten first
+static uint32_t textSeen[TEXT_CACHE_SEEN];
+static uint8_t textSeenNext = 0;
+
+static uint32_t textHash(const std::string &text)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+    for (char c : text)
+    {
+        h = (h ^ (uint8_t)c) * 16777619u;
+    }
+    return h;
+}
+
+static void evictText(uint32_t budget)
+{
+    while (!textCache.empty() && textCacheStats.bytes > budget)
+    {
+        textCacheStats.bytes -= textCache.back().bytes();
+        textCacheStats.entries--;
+        textCacheStats.evictions++;
+        textCache.pop_back();
+    }
+}
+
+// Lay the glyphs of `entry.text` out into its strip
+static void renderText(CachedText &entry, const Font &font, const GlyphAtlas &atlas)
+{
+    int lines = 1, chars = 0, widest = 0;
+    for (size_t i = 0; i < entry.text.length();)
+    {
+        uint32_t cp = nextCodePoint(entry.text, i);
+        if (cp == '\n')
+        {
+            lines++;
+            chars = 0;
+        }
+        else if (cp >= 32)
+        {
+            widest = std::max(widest, ++chars);
+        }
+    }
+    entry.width = widest * font.charWidth;
+    entry.height = lines * (font.charHeight + 2) - 2;
+    int words = (entry.height + 31) / 32;
+    entry.bits.assign((size_t)entry.width * words, 0);
+
+    int x = 0, y = 0;
+    for (size_t i = 0; i < entry.text.length();)
+    {
+        uint32_t cp = nextCodePoint(entry.text, i);
+        if (cp == '\n')
+        {
+            y += font.charHeight + 2;
+            x = 0;
+            continue;
+        }
+        if (cp < 32)
+        {
+            continue;
+        }
+        const uint32_t *mask = atlas.glyph(cp);
+        for (int c = 0; mask && c < atlas.width; ++c)
+        {
+            uint32_t *col = entry.bits.data() + (x + c) * words;
+            for (int row = 0; row < atlas.height; ++row)
+            {
+                if ((mask[c * atlas.words + (row >> 3)] >> ((row & 7) * 4)) & 1)
+                {
+                    col[(y + row) >> 5] |= 1u << ((y + row) & 31);
+                }
+            }
+        }
+        x += font.charWidth;
+    }
+}
+
+/**
+ * Strip for `text` in `font`, or nullptr if it doesn't fit in the budget or hasn't been seen before.
+ * A string is only rendered into the cache on its second miss, so text that changes every frame
+ * (scores, timers) is drawn from the atlas without pushing the strips that do repeat out.
+ * Colour isn't part of the key: the strip is a mask, coloured when it's drawn.
+ */
+static const CachedText *cachedText(const std::string &text, const Font &font)
+{
+    uint64_t key[4];
+    atlasKey(font, key);
+    uint32_t hash = textHash(text);
+    for (auto it = textCache.begin(); it != textCache.end(); ++it)
+    {
+        if (it->hash == hash && memcmp(it->font, key, sizeof(key)) == 0 && it->text == text)
+        {
+            textCache.splice(textCache.begin(), textCache, it);
+            textCacheStats.hits++;
+            return &textCache.front();
+        }
+    }
+
+    textCacheStats.misses++;
+    uint32_t tag = hash;
+    for (uint64_t k : key)
+    {
+        tag = (tag ^ (uint32_t)k ^ (uint32_t)(k >> 32)) * 16777619u;
+    }
+    tag |= 1; // Never 0, which marks an empty slot
+    uint32_t *seen = std::find(textSeen, textSeen + TEXT_CACHE_SEEN, tag);
+    if (seen == textSeen + TEXT_CACHE_SEEN)
+    {
+        textSeen[textSeenNext] = tag;
+        textSeenNext = (textSeenNext + 1) % TEXT_CACHE_SEEN;
+        textCacheStats.skipped++;
+        return nullptr;
+    }
+    *seen = 0;
+
+    CachedText entry;
+    entry.text = text;
+    memcpy(entry.font, key, sizeof(key));
+    entry.hash = hash;
+    renderText(entry, font, glyphAtlas(font));
+    uint32_t size = entry.bytes();
+    if (size > textCacheStats.budget)
+    {
+        return nullptr;
+    }
+    evictText(textCacheStats.budget - size);
+    textCache.push_front(std::move(entry));
+    textCacheStats.entries++;
+    textCacheStats.bytes += size;
+    return &textCache.front();
+}
+
+const TextCacheStats &getTextCacheStats()
+{
+    return textCacheStats;
+}
+
+// Bytes the text cache may use; 0 turns it off
+void setTextCacheBudget(uint32_t bytes)
+{
+    textCacheStats.budget = bytes;
+    evictText(bytes);
+}
+
+void clearTextCache()
+{
+    evictText(0);
+    textCacheStats.hits = textCacheStats.misses = textCacheStats.skipped = textCacheStats.evictions = 0;
+    memset(textSeen, 0, sizeof(textSeen));
 }
 
 // Function to print text on an image
@@ -136,133 +435,86 @@ void imagePrint(
     const Font *font = nullptr,
     const std::vector<TextEffectState> *offsets = nullptr)
 {
-
-    x = std::floor(x);
-    y = std::floor(y);
     if (screen::sleepmode)
     {
-        return
+        return;
     }
     if (!font)
     {
         font = &getFontForText(text);
     }
 
-    int x0 = x;
-    size_t cp = 0;
-    int mult = font->multiplier ? font->multiplier : 1;
-
-    int dataW = font->charWidth / mult;
-    int dataH = font->charHeight / mult;
-
-    int byteHeight = (dataH + 7) >> 3; // Divide by 8 and round up
-    int charSize = byteHeight * dataW;
-    int dataSize = 2 + charSize;
-
-    const std::vector<uint64_t> &fontdata = font->data;
-    int lastchar = static_cast<int>(fontdata.size() / dataSize) - 1;
-
-    std::vector<uint8_t> imgBuf;
-    if (mult == 1)
+    // Text without per-character effects looks the same every time, so draw it from the cache
+    if (!offsets && textCacheStats.budget)
     {
-        imgBuf.resize(8 + charSize);
-        imgBuf[0] = 0x87;
-        imgBuf[1] = 1;
-        imgBuf[2] = dataW;
-        imgBuf[4] = dataH;
-    }
-
-    while (cp < text.length())
-    {
-        int xOffset = 0, yOffset = 0;
-
-        if (offsets && cp < offsets->size())
+        const CachedText *strip = cachedText(text, *font);
+        if (strip)
         {
-            xOffset = (*offsets)[cp].xOffset;
-            yOffset = (*offsets)[cp].yOffset;
+            img.drawBitMask(strip->bits.data(), strip->width, strip->height, x, y, color);
+            return;
         }
+    }
 
-        char ch = text[cp++];
-        if (ch == '\n')
+    const GlyphAtlas &atlas = glyphAtlas(*font);
+    int mult = font->multiplier ? font->multiplier : 1;
+    int x0 = x;
+    size_t index = 0; // Character number, for the effect offsets
+
+    for (size_t i = 0; i < text.length(); ++index)
+    {
+        uint32_t cp = nextCodePoint(text, i);
+        if (cp == '\n')
         {
             y += font->charHeight + 2;
             x = x0;
             continue;
         }
-
-        if (ch < 32)
+        if (cp < 32)
         {
             continue;
         }
 
-        int l = 0, r = lastchar, off = 0;
-        int guess = (ch - 32) * dataSize;
-        if (fontdata[guess / dataSize] == ch)
-        {
-            off = guess;
-        }
-        else
+        int xOffset = 0, yOffset = 0;
+        if (offsets && index < offsets->size())
         {
-            while (l <= r)
-            {
-                int m = l + ((r - l) >> 1);
-                int v = fontdata[m * dataSize / sizeof(uint64_t)];
-                if (v == ch)
-                {
-                    off = m * dataSize;
-                    break;
-                }
-                if (v < ch)
-                {
-                    l = m + 1;
-                }
-                else
-                {
-                    r = m - 1;
-                }
-            }
+            xOffset = (*offsets)[index].xOffset * mult;
+            yOffset = (*offsets)[index].yOffset * mult;
         }
 
-        if (mult == 1)
-        {
-            std::copy(fontdata.begin() + off + 2, fontdata.begin() + off + 2 + charSize, imgBuf.begin() + 8);
-            img.drawIcon(imgBuf, dataW, dataH, x + xOffset, y + yOffset, color);
-            x += font->charWidth;
-        }
-        else
+        const uint32_t *mask = atlas.glyph(cp);
+        if (mask)
         {
-            off += 2;
-            for (int i = 0; i < dataW; ++i)
-            {
-                int j = 0;
-                uint8_t mask = 0x01;
-                uint8_t c = fontdata[off++];
-                while (j < dataH)
-                {
-                    if (mask == 0x100)
-                    {
-                        c = fontdata[off++];
-                        mask = 0x01;
-                    }
-                    int n = 0;
-                    while (c & mask)
-                    {
-                        n++;
-                        mask <<= 1;
-                    }
-                    if (n)
-                    {
-                        img.fillRect(x + xOffset * mult, y + (j + yOffset) * mult, mult, mult * n, color);
-                        j += n;
-                    }
-                    else
-                    {
-                        mask <<= 1;
-                        j++;
-                    }
-                }
-                x += mult;
-            }
+            img.drawMask(mask, atlas.width, atlas.height, x + xOffset, y + yOffset, color);
         }
+        x += font->charWidth;
     }
 }
+
+// Function to print text centered
+bool imagePrintCenter(Image &img, const std::string &text, int y, int color = -1, const Font *font = nullptr)
+{
+    if (screen::sleepmode)
+    {
+        return false;
+    }
+
+    if (!font)
+    {
+        font = &getFontForText(text);
+    }
+
+    // Width in characters, not bytes
+    int chars = 0;
+    for (size_t i = 0; i < text.length(); ++chars)
+    {
+        nextCodePoint(text, i);
+    }
+    int w = chars * font->charWidth;
+    int x = std::floor((img.getWidth() - w) / 2.0);
+
+    // Call the `imagePrint` function
+    imagePrint(img, text, x, y, color, font);
+
+    // Indicate success
+    return true;
+}
@@ -2,6 +2,16 @@
 #include <thread>
 #include <chrono>
 #include <functional>
+#include <algorithm>
+#include "frame.h"
+#include "PM.h"
+#include "Input.h"
+#include "OSconfig.h"
+#include "CodalFiber.h"
+#include "Timer.h"
+#include "EventModel.h"
+#include "Pin.h"
+#include "codal_target_hal.h"
 
 namespace screen
 {
@@ -9,6 +19,7 @@ namespace screen
     bool updated = false;
     bool sleepmode = false;   // Sleep mode flag
     uint8_t frameCounter = 0; // Tracks frames in sleep mode (optimized with uint8)
+    static uint32_t frameRenderUs = 0; // Render time of the frame being pushed, set by the frame pacer
 
     void update()
     {
@@ -29,11 +40,16 @@ namespace screen
         }
 
         // Normal update behavior in active mode
+        uint64_t pushStart = codal::system_timer_current_time_us();
         if (update_callback)
         {
             update_callback();
         }
         updated = true;
+        // Frame work feeds the clock governor; frames drawn outside the pacer only count their push
+        PM::FrameTick(frameRenderUs + (uint32_t)(codal::system_timer_current_time_us() - pushStart));
+        frameRenderUs = 0;
+        AdvanceInputFrame(); // Frame numbers drive input record/replay
     }
 
     void setup_update(std::function<void()> update)
@@ -43,19 +59,231 @@ namespace screen
         update(); // Immediate refresh on setup
     }
 
-    void fallback_refresh()
+    // Frame pacer: a timer event counts ticks and a fiber renders a frame per slot
+    static std::function<void()> render_callback = nullptr;
+    static FrameTiming timing = {};
+    static uint32_t periodUs = 0;
+    static uint8_t skipPolicy = FRAME_SKIP_DROP;
+    static uint8_t lateFrames = 0, spareFrames = 0;
+    static bool pacerRunning = false, pacerFiber = false, pacerListening = false;
+    static volatile uint32_t ticks = 0;
+    static volatile uint64_t lastTickUs = 0;
+
+    static codal::Pin *tePin = nullptr;
+    static volatile uint64_t lastTeUs = 0;
+
+    static void onTick(codal::Event)
+    {
+        if (!pacerRunning)
+        {
+            return; // The wake-up sent by stop_frame_pacer()
+        }
+        lastTickUs = codal::system_timer_current_time_us();
+        ticks++;
+    }
+
+    static void onTearingEffect(codal::Event)
+    {
+        lastTeUs = codal::system_timer_current_time_us();
+        codal::Event(DEVICE_ID_OS_DISPLAY, FRAME_EVT_TE);
+    }
+
+    // Sleep until the tick count reaches `due`
+    static void waitForTick(uint32_t due)
+    {
+        while (true)
+        {
+            target_disable_irq();
+            if ((int32_t)(ticks - due) >= 0 || !pacerRunning)
+            {
+                target_enable_irq();
+                return;
+            }
+            codal::fiber_wake_on_event(DEVICE_ID_OS_DISPLAY, FRAME_EVT_TICK);
+            target_enable_irq();
+            codal::schedule();
+        }
+    }
+
+    // Wait for the next TE edge, but no longer than a period: a panel that stops pulsing gets the frame anyway
+    static void waitForTearingEffect()
+    {
+        uint64_t start = codal::system_timer_current_time_us();
+        if (!tePin || start - lastTeUs >= 2 * (uint64_t)periodUs)
+        {
+            return;
+        }
+        codal::system_timer_event_after_us(periodUs, DEVICE_ID_OS_DISPLAY, FRAME_EVT_TE);
+        while (true)
+        {
+            target_disable_irq();
+            if (lastTeUs > start || codal::system_timer_current_time_us() - start >= periodUs)
+            {
+                target_enable_irq();
+                break;
+            }
+            codal::fiber_wake_on_event(DEVICE_ID_OS_DISPLAY, FRAME_EVT_TE);
+            target_enable_irq();
+            codal::schedule();
+        }
+        codal::system_timer_cancel_event(DEVICE_ID_OS_DISPLAY, FRAME_EVT_TE);
+    }
+
+    static void adapt(bool missed, uint32_t frameUs)
     {
+        uint32_t slotUs = periodUs * timing.divider;
+        if (missed)
+        {
+            spareFrames = 0;
+            if (++lateFrames >= FRAME_ADAPT_MISSES && timing.divider < FRAME_MAX_DIVIDER)
+            {
+                timing.divider *= 2;
+                lateFrames = 0;
+            }
+            return;
+        }
+        lateFrames = 0;
+        // Doubling the rate halves the slot, so only speed up with half of it to spare
+        if (timing.divider > 1 && frameUs * 2 < slotUs / 2)
+        {
+            if (++spareFrames >= FRAME_ADAPT_RECOVER)
+            {
+                timing.divider /= 2;
+                spareFrames = 0;
+            }
+        }
+        else
+        {
+            spareFrames = 0;
+        }
+    }
+
+    static void pacerLoop()
+    {
+        uint32_t due = ticks + 1;
         while (true)
         {
+            waitForTick(due);
+            if (!pacerRunning)
+            {
+                break;
+            }
+            uint32_t start = ticks;
+            uint64_t slotStart = lastTickUs;
+            uint64_t deadline = slotStart + (uint64_t)periodUs * timing.divider;
+
+            uint64_t t0 = codal::system_timer_current_time_us();
+            if (render_callback)
+            {
+                render_callback();
+            }
+            uint64_t t1 = codal::system_timer_current_time_us();
+            waitForTearingEffect();
             updated = false;
-            std::this_thread::sleep_for(std::chrono::milliseconds(16)); // Approx. 60 FPS timing
-            screen::update();                                           // Trigger updates based on the current mode
+            frameRenderUs = (uint32_t)(t1 - t0);
+            screen::update();
+            uint64_t t2 = codal::system_timer_current_time_us();
+
+            timing.frames++;
+            timing.renderUs = (uint32_t)(t1 - t0);
+            timing.presentUs = (uint32_t)(t2 - t1);
+            timing.maxRenderUs = std::max(timing.maxRenderUs, timing.renderUs);
+            timing.maxPresentUs = std::max(timing.maxPresentUs, timing.presentUs);
+            timing.totalRenderUs += timing.renderUs;
+            timing.totalPresentUs += timing.presentUs;
+            bool missed = t2 > deadline;
+            if (missed)
+            {
+                timing.missed++;
+            }
+
+            uint32_t now = ticks;
+            if (skipPolicy == FRAME_SKIP_NONE)
+            {
+                // Catch up with at most one frame straight away, rather than a burst
+                uint32_t next = start + timing.divider;
+                due = (int32_t)(next - now) > 0 ? next : now;
+            }
+            else
+            {
+                if (skipPolicy == FRAME_SKIP_ADAPTIVE)
+                {
+                    adapt(missed, (uint32_t)(t2 - slotStart));
+                }
+                timing.skipped += (now - start) / timing.divider;
+                due = now + timing.divider - (now - start) % timing.divider;
+            }
+        }
+        pacerFiber = false;
+    }
+
+    void start_frame_pacer(uint32_t fps, std::function<void()> render, uint8_t policy)
+    {
+        if (fps == 0 || !codal::EventModel::defaultEventBus)
+        {
+            return;
+        }
+        stop_frame_pacer();
+        if (!pacerListening)
+        {
+            codal::EventModel::defaultEventBus->listen(DEVICE_ID_OS_DISPLAY, FRAME_EVT_TICK, onTick, MESSAGE_BUS_LISTENER_IMMEDIATE);
+            pacerListening = true;
         }
+        render_callback = render;
+        skipPolicy = policy;
+        periodUs = 1000000 / fps;
+        timing.divider = 1;
+        lateFrames = spareFrames = 0;
+        pacerRunning = true;
+        codal::system_timer_event_every_us(periodUs, DEVICE_ID_OS_DISPLAY, FRAME_EVT_TICK);
+        if (!pacerFiber)
+        {
+            pacerFiber = true;
+            codal::create_fiber(pacerLoop);
+        }
+    }
+
+    void stop_frame_pacer()
+    {
+        if (!pacerRunning)
+        {
+            return;
+        }
+        pacerRunning = false;
+        codal::system_timer_cancel_event(DEVICE_ID_OS_DISPLAY, FRAME_EVT_TICK);
+        codal::Event(DEVICE_ID_OS_DISPLAY, FRAME_EVT_TICK); // Let the fiber see it should exit
+    }
+
+    void set_frame_sync(codal::Pin *te)
+    {
+        if (tePin && codal::EventModel::defaultEventBus)
+        {
+            codal::EventModel::defaultEventBus->ignore(tePin->id, DEVICE_PIN_EVT_RISE, onTearingEffect);
+        }
+        tePin = te;
+        lastTeUs = 0;
+        if (te && codal::EventModel::defaultEventBus)
+        {
+            te->eventOn(DEVICE_PIN_EVENT_ON_EDGE);
+            codal::EventModel::defaultEventBus->listen(te->id, DEVICE_PIN_EVT_RISE, onTearingEffect, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        }
+    }
+
+    const FrameTiming &frame_timing()
+    {
+        return timing;
+    }
+
+    void reset_frame_timing()
+    {
+        uint8_t divider = timing.divider;
+        timing = {};
+        timing.divider = divider;
     }
 
     void start_fallback_refresh()
     {
-        std::thread(fallback_refresh).detach();
+        start_frame_pacer(FRAME_DEFAULT_FPS, nullptr);
     }
 
     void wake()
@@ -78,4 +306,4 @@ namespace screen
         std::this_thread::sleep_for(std::chrono::milliseconds(durationInMilliseconds)); // Simulate sleep duration
         wake();                                                                         // Automatically exit sleep mode after duration
     }
-}
\ No newline at end of file
+}
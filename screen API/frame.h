@@ -5,9 +5,42 @@
 #include <thread>
 #include <chrono>
 #include <functional>
+#include <cstdint>
+
+namespace codal
+{
+    class Pin;
+}
+
+#define FRAME_DEFAULT_FPS 60
+#define FRAME_EVT_TICK 2 // Pacer tick on DEVICE_ID_OS_DISPLAY
+#define FRAME_EVT_TE 3   // Tearing effect edge, or the pacer giving up on it, on DEVICE_ID_OS_DISPLAY
+
+// What the pacer does with a frame that overruns its slot
+#define FRAME_SKIP_NONE 0     // Start the next frame at once; the frame rate sags but no frame is dropped
+#define FRAME_SKIP_DROP 1     // Wait for the next free slot, dropping the ones the frame overran
+#define FRAME_SKIP_ADAPTIVE 2 // Like DROP, and halve the rate while frames keep missing
+
+#define FRAME_ADAPT_MISSES 3   // Missed frames in a row before the rate is halved
+#define FRAME_ADAPT_RECOVER 60 // Frames with half the slot to spare before it is doubled again
+#define FRAME_MAX_DIVIDER 4    // Lowest adaptive rate: a quarter of the target
 
 namespace screen
 {
+    struct FrameTiming
+    {
+        uint32_t frames;         // Frames presented
+        uint32_t missed;         // Frames presented after their deadline
+        uint32_t skipped;        // Slots dropped because the frame before overran
+        uint32_t renderUs;       // Last frame: render callback
+        uint32_t presentUs;      // Last frame: vsync wait and screen::update
+        uint32_t maxRenderUs;
+        uint32_t maxPresentUs;
+        uint64_t totalRenderUs;
+        uint64_t totalPresentUs;
+        uint8_t divider;         // Ticks per frame, above 1 while the adaptive policy has slowed down
+    };
+
     extern std::function<void()> update_callback;
     extern bool updated;
     extern bool sleepmode;
@@ -15,11 +48,32 @@ namespace screen
 
     void update();
     void setup_update(std::function<void()> update);
-    void fallback_refresh();
     void start_fallback_refresh();
+
+    /**
+     * @brief Run frames off the system timer: each tick calls `render`, then screen::update.
+     *
+     * Frames are timed from the tick, so render time counts against the slot instead of adding to it.
+     * @param fps Target frame rate.
+     * @param render Draws the frame, or nullptr to only update.
+     * @param skipPolicy FRAME_SKIP_*.
+     */
+    void start_frame_pacer(uint32_t fps, std::function<void()> render, uint8_t skipPolicy = FRAME_SKIP_DROP);
+    void stop_frame_pacer();
+
+    /**
+     * @brief Present frames on the rising edge of the panel's tearing effect (TE) output.
+     *
+     * Only waited for while edges keep arriving, so a panel with TE off doesn't stall the pacer.
+     * @param te The pin TE is wired to, or nullptr to stop syncing.
+     */
+    void set_frame_sync(codal::Pin *te);
+
+    const FrameTiming &frame_timing();
+    void reset_frame_timing();
     void wake();
     void enter_sleep();
     void timed_sleep(uint32_t durationInMilliseconds);
 }
 
-#endif // FRAME_H
\ No newline at end of file
+#endif // FRAME_H
@@ -1,32 +1,368 @@
+#ifndef IMAGE_D_CPP
+#define IMAGE_D_CPP
+
 #include <vector>
 #include <cstdint>
+#include <cstring>
 #include <cmath>
 #include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// Pixels are 4bpp palette indices stored column-major, the layout of pxt's 4bpp
+// RefImage and the order the display is fed in: each column is `byteHeight` bytes,
+// word aligned, with the even row in the low nibble of every byte.
+#define IMAGE_BPP 4
+#define IMAGE_COLOR_MASK 0x0F
+
+// Kernels work a 32-bit word (8 rows of one column) at a time; nibble n of a word is row n,
+// which relies on the little-endian byte order of the Cortex-M4 and the host
+#define IMAGE_ROWS_PER_WORD 8
+
+// Changed areas kept per image between display pushes; more than this get merged
+#ifndef IMAGE_DIRTY_RECTS
+#define IMAGE_DIRTY_RECTS 4
+#endif
+
+// A changed area, [x0, x1) x [y0, y1)
+struct DirtyRect
+{
+    int16_t x0, y0, x1, y1;
+
+    int area() const { return (x1 - x0) * (y1 - y0); }
+};
 
 class Image
 {
 private:
     int width, height;
-    std::vector<std::vector<uint32_t>> pixels; // 2D array for pixel data
+    int byteHeight;               // Bytes per column (the stride), a multiple of 4
+    std::vector<uint32_t> buffer; // width * byteHeight bytes, one allocation
+    DirtyRect dirty[IMAGE_DIRTY_RECTS];
+    int dirtyCount = 0;
 
-public:
-    // Constructor
-    Image(int w, int h) : width(w), height(h), pixels(h, std::vector<uint32_t>(w, 0)) {}
+    static DirtyRect unite(const DirtyRect &a, const DirtyRect &b)
+    {
+        return {std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1)};
+    }
 
-    // Fill a rectangle
-    void fillRect(int x, int y, int w, int h, uint32_t color)
+    // Overlapping or sharing an edge, so the union costs no extra pixels along that edge
+    static bool touches(const DirtyRect &a, const DirtyRect &b)
+    {
+        return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+    }
+
+    void addDirty(DirtyRect r)
+    {
+        for (int i = 0; i < dirtyCount;)
+        {
+            if (touches(dirty[i], r))
+            {
+                // The union may now reach rectangles already checked, so start over
+                r = unite(dirty[i], r);
+                dirty[i] = dirty[--dirtyCount];
+                i = 0;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        if (dirtyCount == IMAGE_DIRTY_RECTS)
+        {
+            // Full: fold into the rectangle whose union wastes the fewest pixels
+            int best = 0, bestWaste = 0;
+            for (int i = 0; i < dirtyCount; ++i)
+            {
+                int waste = unite(dirty[i], r).area() - dirty[i].area() - r.area();
+                if (i == 0 || waste < bestWaste)
+                {
+                    best = i;
+                    bestWaste = waste;
+                }
+            }
+            r = unite(dirty[best], r);
+            dirty[best] = dirty[--dirtyCount];
+            addDirty(r);
+            return;
+        }
+        dirty[dirtyCount++] = r;
+    }
+
+    static int byteHeightFor(int h) { return ((h * IMAGE_BPP + 31) >> 5) << 2; }
+
+    uint8_t *pix(int x, int y) { return bytes() + x * byteHeight + (y >> 1); }
+    const uint8_t *pix(int x, int y) const { return bytes() + x * byteHeight + (y >> 1); }
+
+    void setPixelUnchecked(int x, int y, uint32_t color)
+    {
+        uint8_t *p = pix(x, y);
+        color &= IMAGE_COLOR_MASK;
+        *p = (y & 1) ? (*p & 0x0F) | (color << 4) : (*p & 0xF0) | color;
+    }
+
+    uint32_t getPixelUnchecked(int x, int y) const
+    {
+        const uint8_t *p = pix(x, y);
+        return (y & 1) ? *p >> 4 : *p & 0x0F;
+    }
+
+    uint32_t *column(int x) { return buffer.data() + x * (byteHeight >> 2); }
+    const uint32_t *column(int x) const { return buffer.data() + x * (byteHeight >> 2); }
+
+    // A colour repeated in all 8 nibbles of a word
+    static uint32_t nibbles(uint32_t color) { return (color & IMAGE_COLOR_MASK) * 0x11111111u; }
+
+    // Nibbles [from, to) of a word, 0 <= from < to <= 8
+    static uint32_t spanMask(int from, int to)
+    {
+        uint32_t below = to == IMAGE_ROWS_PER_WORD ? 0xFFFFFFFFu : (1u << (to * 4)) - 1;
+        return below & ~((1u << (from * 4)) - 1);
+    }
+
+    static void storeMasked(uint32_t *word, uint32_t value, uint32_t mask)
+    {
+        *word = (*word & ~mask) | (value & mask);
+    }
+
+    // Rows [y0, y1) of one column: masked words at either end, whole words between
+    static void fillColumn(uint32_t *col, int y0, int y1, uint32_t pattern)
+    {
+        int w0 = y0 >> 3, w1 = (y1 - 1) >> 3;
+        if (w0 == w1)
+        {
+            storeMasked(col + w0, pattern, spanMask(y0 & 7, ((y1 - 1) & 7) + 1));
+            return;
+        }
+        storeMasked(col + w0, pattern, spanMask(y0 & 7, IMAGE_ROWS_PER_WORD));
+        for (int w = w0 + 1; w < w1; ++w)
+        {
+            col[w] = pattern;
+        }
+        storeMasked(col + w1, pattern, spanMask(0, ((y1 - 1) & 7) + 1));
+    }
+
+    // 8 nibbles of a column starting at row `row`; rows outside the column read as 0
+    static uint32_t nibbleWindow(const uint32_t *col, int words, int row)
+    {
+        int index = row >> 3; // Rounds down for rows above the column too
+        int shift = (row & 7) * 4;
+        uint32_t low = index >= 0 && index < words ? col[index] : 0;
+        if (shift == 0)
+        {
+            return low;
+        }
+        uint32_t high = index + 1 >= 0 && index + 1 < words ? col[index + 1] : 0;
+        return (low >> shift) | (high << (32 - shift));
+    }
+
+    // 0xF in every non-zero nibble of `w`, 0 elsewhere: colour 0 is transparent
+    static uint32_t opaqueNibbles(uint32_t w)
+    {
+        uint32_t nonZero = (((w & 0x77777777u) + 0x77777777u) | w) & 0x88888888u;
+        return (nonZero >> 3) * 0xF;
+    }
+
+    // Gather bit 0 of each nibble into the low 8 bits, nibble n to bit n; the inverse of spreadBits
+    static uint32_t gatherBits(uint32_t w)
+    {
+        w &= 0x11111111u;
+        w = (w | w >> 3) & 0x03030303u;
+        w = (w | w >> 6) & 0x000F000Fu;
+        return (w | w >> 12) & 0xFFu;
+    }
+
+    // Spread the low 8 bits of `b` one per nibble, bit n to nibble n
+    static uint32_t spreadBits(uint32_t b)
+    {
+        b = (b | (b << 12)) & 0x000F000Fu;
+        b = (b | (b << 6)) & 0x03030303u;
+        b = (b | (b << 3)) & 0x11111111u;
+        return b * 0xF;
+    }
+
+    // 8 rows of a 1bpp column starting at row `row`, as a nibble mask; rows outside the column read as 0
+    static uint32_t bitWindow(const uint32_t *col, int words, int row)
+    {
+        int index = row >> 5;
+        int shift = row & 31;
+        uint32_t bits = index >= 0 && index < words ? col[index] >> shift : 0;
+        if (shift > 24 && index + 1 >= 0 && index + 1 < words)
+        {
+            bits |= col[index + 1] << (32 - shift);
+        }
+        return spreadBits(bits & 0xFF);
+    }
+
+    // Move the rows of one column by `dy` (down if positive) in place; rows moved in from above read as 0
+    static void shiftColumn(uint32_t *col, int words, int dy)
+    {
+        if ((dy & 7) == 0)
+        {
+            int by = dy / IMAGE_ROWS_PER_WORD;
+            if (by > 0)
+            {
+                memmove(col + by, col, (words - by) * sizeof(uint32_t));
+            }
+            else
+            {
+                memmove(col, col - by, (words + by) * sizeof(uint32_t));
+            }
+            return;
+        }
+        // Walk away from the direction of travel, so every word is read before it's overwritten
+        if (dy > 0)
+        {
+            for (int w = words - 1; w >= 0; --w)
+            {
+                col[w] = nibbleWindow(col, words, w * IMAGE_ROWS_PER_WORD - dy);
+            }
+        }
+        else
+        {
+            for (int w = 0; w < words; ++w)
+            {
+                col[w] = nibbleWindow(col, words, w * IMAGE_ROWS_PER_WORD - dy);
+            }
+        }
+    }
+
+    static uint32_t reverseNibbles(uint32_t w)
+    {
+        w = __builtin_bswap32(w);
+        return ((w >> 4) & 0x0F0F0F0Fu) | ((w & 0x0F0F0F0Fu) << 4);
+    }
+
+    // The low 4 nibbles of `h`, each repeated twice
+    static uint32_t doubleNibbles(uint32_t h)
+    {
+        h &= 0xFFFF;
+        h = (h | (h << 8)) & 0x00FF00FFu;
+        h = (h | (h << 4)) & 0x0F0F0F0Fu;
+        return h | (h << 4);
+    }
+
+    // Opaque blits with matching row alignment are plain word copies, unrolled by 4
+    static void copyWords(uint32_t *dst, const uint32_t *src, int count)
+    {
+        for (; count >= 4; count -= 4, dst += 4, src += 4)
+        {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst[3] = src[3];
+        }
+        while (count--)
+        {
+            *dst++ = *src++;
+        }
+    }
+
+    // Transparent blit: `mask` words are laid out like `from`'s pixels, or computed from them when null
+    void blitMasked(const Image &from, const uint32_t *mask, int x, int y)
     {
-        for (int i = y; i < y + h; ++i)
+        int x0 = std::max(x, 0), x1 = std::min(x + from.width, width);
+        int y0 = std::max(y, 0), y1 = std::min(y + from.height, height);
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+        markDirty(x0, y0, x1, y1);
+        int words = from.byteHeight >> 2;
+        int w0 = y0 >> 3, w1 = (y1 - 1) >> 3;
+        for (int i = x0; i < x1; ++i)
         {
-            for (int j = x; j < x + w; ++j)
+            uint32_t *dst = column(i);
+            const uint32_t *src = from.column(i - x);
+            const uint32_t *see = mask ? mask + (i - x) * words : nullptr;
+            for (int k = w0; k <= w1; ++k)
             {
-                if (i >= 0 && i < height && j >= 0 && j < width)
+                int first = k == w0 ? y0 & 7 : 0;
+                int last = k == w1 ? ((y1 - 1) & 7) + 1 : IMAGE_ROWS_PER_WORD;
+                int row = k * IMAGE_ROWS_PER_WORD - y;
+                uint32_t pixels = nibbleWindow(src, words, row);
+                uint32_t opaque = (see ? nibbleWindow(see, words, row) : opaqueNibbles(pixels)) & spanMask(first, last);
+                if (opaque)
                 {
-                    pixels[i][j] = color;
+                    storeMasked(dst + k, pixels, opaque);
                 }
             }
         }
     }
+
+public:
+    // Constructor
+    Image(int w, int h) : width(w), height(h), byteHeight(byteHeightFor(h)), buffer(w * byteHeightFor(h) / 4, 0)
+    {
+        markDirty(0, 0, w, h); // Never displayed, so all of it is new
+        ++allocations();
+    }
+
+    Image(const Image &other)
+        : width(other.width), height(other.height), byteHeight(other.byteHeight), buffer(other.buffer), dirtyCount(other.dirtyCount)
+    {
+        std::copy(other.dirty, other.dirty + other.dirtyCount, dirty);
+        ++allocations();
+    }
+
+    Image(Image &&) = default;
+    Image &operator=(const Image &) = default;
+    Image &operator=(Image &&) = default;
+
+    // Pixel buffers allocated by constructors so far, for benchmarks
+    static uint32_t &allocations()
+    {
+        static uint32_t count = 0;
+        return count;
+    }
+
+    /**
+     * Record that [x0, x1) x [y0, y1) changed since the last display push. Drawing methods do
+     * this themselves; call it after writing through `bytes()` or `pix()`.
+     */
+    void markDirty(int x0, int y0, int x1, int y1)
+    {
+        x0 = std::max(x0, 0), y0 = std::max(y0, 0);
+        x1 = std::min(x1, width), y1 = std::min(y1, height);
+        if (x0 < x1 && y0 < y1)
+        {
+            addDirty({(int16_t)x0, (int16_t)y0, (int16_t)x1, (int16_t)y1});
+        }
+    }
+
+    // Areas changed since `clearDirty()`, disjoint and at most IMAGE_DIRTY_RECTS of them
+    int getDirtyCount() const { return dirtyCount; }
+    const DirtyRect &getDirtyRect(int i) const { return dirty[i]; }
+    void clearDirty() { dirtyCount = 0; }
+
+    // Raw pixel storage, e.g. for DMA to the display
+    uint8_t *bytes() { return (uint8_t *)buffer.data(); }
+    const uint8_t *bytes() const { return (const uint8_t *)buffer.data(); }
+    int stride() const { return byteHeight; }
+    int byteLength() const { return width * byteHeight; }
+
+    // Fill a rectangle, clipped once up front
+    void fillRect(int x, int y, int w, int h, uint32_t color)
+    {
+        int x0 = std::max(x, 0), x1 = std::min(x + w, width);
+        int y0 = std::max(y, 0), y1 = std::min(y + h, height);
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+        markDirty(x0, y0, x1, y1);
+        uint32_t pattern = nibbles(color);
+        if (y0 == 0 && y1 == height)
+        {
+            // Full height columns are one contiguous run (padding included)
+            memset(bytes() + x0 * byteHeight, pattern & 0xFF, (x1 - x0) * byteHeight);
+            return;
+        }
+        for (int i = x0; i < x1; ++i)
+        {
+            fillColumn(column(i), y0, y1, pattern);
+        }
+    }
     int getWidth() const { return width; }
     int getHeight() const { return height; }
 
@@ -37,12 +373,13 @@ public:
         int sx = (x0 < x1) ? 1 : -1;
         int sy = (y0 < y1) ? 1 : -1;
         int err = dx - dy;
+        markDirty(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1) + 1, std::max(y0, y1) + 1);
 
         while (true)
         {
             if (x0 >= 0 && x0 < width && y0 >= 0 && y0 < height)
             {
-                pixels[y0][x0] = color;
+                setPixelUnchecked(x0, y0, color);
             }
             if (x0 == x1 && y0 == y1)
                 break;
@@ -59,17 +396,257 @@ public:
             }
         }
     }
+    // Draw the non-zero pixels of a row-major, byte per pixel icon in one colour
     void drawIcon(const std::vector<uint8_t> &icon, int iconWidth, int iconHeight, int x, int y, uint32_t color)
     {
-        for (int i = 0; i < iconHeight; ++i)
-        { // Loop over rows
-            for (int j = 0; j < iconWidth; ++j)
-            {                                  // Loop over columns
-                int index = i * iconWidth + j; // Calculate the 1D index in the icon data
-                if (icon[index] != 0)
-                {                                  // Only draw "on" pixels (non-zero values)
-                    setPixel(x + j, y + i, color); // Set the corresponding pixel in the image
+        int j0 = std::max(-x, 0), j1 = std::min(iconWidth, width - x);
+        int i0 = std::max(-y, 0), i1 = std::min(iconHeight, height - y);
+        if (j0 >= j1 || i0 >= i1)
+        {
+            return;
+        }
+        markDirty(x + j0, y + i0, x + j1, y + i1);
+        uint32_t pattern = nibbles(color);
+        for (int j = j0; j < j1; ++j)
+        {
+            // Gather the "on" pixels of each word into a mask, then store the word once
+            uint32_t *col = column(x + j);
+            const uint8_t *bit = icon.data() + i0 * iconWidth + j;
+            for (int row = y + i0, end = y + i1; row < end;)
+            {
+                int wordEnd = std::min((row | 7) + 1, end);
+                uint32_t mask = 0;
+                for (int shift = (row & 7) * 4; row < wordEnd; ++row, shift += 4, bit += iconWidth)
+                {
+                    mask |= (uint32_t)(*bit != 0) * (0xFu << shift);
                 }
+                storeMasked(col + ((row - 1) >> 3), pattern, mask);
+            }
+        }
+    }
+
+    /**
+     * Draw `color` wherever a mask nibble is set. The mask is laid out like an image's pixels:
+     * `maskWidth` columns of (maskHeight + 7) / 8 words, a nibble per row, 0xF for "on".
+     */
+    void drawMask(const uint32_t *mask, int maskWidth, int maskHeight, int x, int y, uint32_t color)
+    {
+        int x0 = std::max(x, 0), x1 = std::min(x + maskWidth, width);
+        int y0 = std::max(y, 0), y1 = std::min(y + maskHeight, height);
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+        markDirty(x0, y0, x1, y1);
+        uint32_t pattern = nibbles(color);
+        int words = (maskHeight + IMAGE_ROWS_PER_WORD - 1) / IMAGE_ROWS_PER_WORD;
+        int w0 = y0 >> 3, w1 = (y1 - 1) >> 3;
+        for (int i = x0; i < x1; ++i)
+        {
+            uint32_t *dst = column(i);
+            const uint32_t *src = mask + (i - x) * words;
+            for (int w = w0; w <= w1; ++w)
+            {
+                int first = w == w0 ? y0 & 7 : 0;
+                int last = w == w1 ? ((y1 - 1) & 7) + 1 : IMAGE_ROWS_PER_WORD;
+                uint32_t bits = nibbleWindow(src, words, w * IMAGE_ROWS_PER_WORD - y) & spanMask(first, last);
+                if (bits)
+                {
+                    storeMasked(dst + w, pattern, bits);
+                }
+            }
+        }
+    }
+
+    /**
+     * Like drawMask, with a 1 bit per pixel mask: `maskWidth` columns of (maskHeight + 31) / 32 words,
+     * bit n of a word for row n.
+     */
+    void drawBitMask(const uint32_t *mask, int maskWidth, int maskHeight, int x, int y, uint32_t color)
+    {
+        int x0 = std::max(x, 0), x1 = std::min(x + maskWidth, width);
+        int y0 = std::max(y, 0), y1 = std::min(y + maskHeight, height);
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+        markDirty(x0, y0, x1, y1);
+        uint32_t pattern = nibbles(color);
+        int words = (maskHeight + 31) / 32;
+        int w0 = y0 >> 3, w1 = (y1 - 1) >> 3;
+        for (int i = x0; i < x1; ++i)
+        {
+            uint32_t *dst = column(i);
+            const uint32_t *src = mask + (i - x) * words;
+            for (int w = w0; w <= w1; ++w)
+            {
+                int first = w == w0 ? y0 & 7 : 0;
+                int last = w == w1 ? ((y1 - 1) & 7) + 1 : IMAGE_ROWS_PER_WORD;
+                uint32_t bits = bitWindow(src, words, w * IMAGE_ROWS_PER_WORD - y) & spanMask(first, last);
+                if (bits)
+                {
+                    storeMasked(dst + w, pattern, bits);
+                }
+            }
+        }
+    }
+
+    // Copy another image on top of this one, every pixel opaque
+    void drawImage(const Image &from, int x, int y)
+    {
+        drawImagePart(from, 0, 0, from.width, from.height, x, y);
+    }
+
+    // Copy the `w` x `h` area of `from` at (sx, sy) to (x, y), every pixel opaque
+    void drawImagePart(const Image &from, int sx, int sy, int w, int h, int x, int y)
+    {
+        // Clip the area to the source first, then to this image
+        if (sx < 0)
+        {
+            w += sx, x -= sx, sx = 0;
+        }
+        if (sy < 0)
+        {
+            h += sy, y -= sy, sy = 0;
+        }
+        w = std::min(w, from.width - sx);
+        h = std::min(h, from.height - sy);
+        int x0 = std::max(x, 0), x1 = std::min(x + w, width);
+        int y0 = std::max(y, 0), y1 = std::min(y + h, height);
+        if (w <= 0 || h <= 0 || x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+        markDirty(x0, y0, x1, y1);
+        int shift = y - sy; // Destination row of source row 0
+        int w0 = y0 >> 3, w1 = (y1 - 1) >> 3;
+        int words = from.byteHeight >> 2;
+        for (int i = x0; i < x1; ++i)
+        {
+            uint32_t *dst = column(i);
+            const uint32_t *src = from.column(i - x + sx);
+            for (int k = w0; k <= w1; ++k)
+            {
+                if ((shift & 7) == 0 && k > w0 && k < w1)
+                {
+                    // Same alignment in both columns: the words between the ends copy straight across
+                    copyWords(dst + k, src + k - (shift >> 3), w1 - k);
+                    k = w1;
+                }
+                int first = k == w0 ? y0 & 7 : 0;
+                int last = k == w1 ? ((y1 - 1) & 7) + 1 : IMAGE_ROWS_PER_WORD;
+                storeMasked(dst + k, nibbleWindow(src, words, k * IMAGE_ROWS_PER_WORD - shift), spanMask(first, last));
+            }
+        }
+    }
+
+    /**
+     * Build the mask drawMaskedImage() takes: this image's layout, 0xF for each non-zero pixel.
+     * @return The number of non-zero pixels, width * height if there is nothing to see through.
+     */
+    int opaqueMask(std::vector<uint32_t> &mask) const
+    {
+        int words = byteHeight >> 2;
+        uint32_t tail = spanMask(0, ((height - 1) & 7) + 1); // The padding rows don't count
+        int count = 0;
+        mask.resize(buffer.size());
+        for (int x = 0; x < width; ++x)
+        {
+            const uint32_t *col = column(x);
+            uint32_t *out = mask.data() + x * words;
+            for (int w = 0; w < words; ++w)
+            {
+                out[w] = opaqueNibbles(col[w]) & (w == words - 1 ? tail : 0xFFFFFFFFu);
+                count += __builtin_popcount(out[w]) >> 2;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Build a 1 bit per pixel mask of the non-zero pixels, laid out like drawBitMask() takes it:
+     * `width` columns of (height + 31) / 32 words, bit n of a word for row n.
+     */
+    void collisionMask(std::vector<uint32_t> &mask) const
+    {
+        int words = byteHeight >> 2, maskWords = (height + 31) / 32;
+        uint32_t tail = spanMask(0, ((height - 1) & 7) + 1);
+        mask.assign(width * maskWords, 0);
+        for (int x = 0; x < width; ++x)
+        {
+            const uint32_t *col = column(x);
+            uint32_t *out = mask.data() + x * maskWords;
+            for (int w = 0; w < words; ++w)
+            {
+                uint32_t opaque = opaqueNibbles(col[w]) & (w == words - 1 ? tail : 0xFFFFFFFFu);
+                out[w >> 2] |= gatherBits(opaque) << ((w & 3) * IMAGE_ROWS_PER_WORD);
+            }
+        }
+    }
+
+    // Whether a non-zero pixel of `other` drawn at (x, y) would land on a non-zero pixel of this image
+    bool overlapsWith(const Image &other, int x, int y) const
+    {
+        int x0 = std::max(x, 0), x1 = std::min(x + other.width, width);
+        int y0 = std::max(y, 0), y1 = std::min(y + other.height, height);
+        if (x0 >= x1 || y0 >= y1)
+        {
+            return false;
+        }
+        int words = other.byteHeight >> 2;
+        int w0 = y0 >> 3, w1 = (y1 - 1) >> 3;
+        for (int i = x0; i < x1; ++i)
+        {
+            const uint32_t *mine = column(i);
+            const uint32_t *theirs = other.column(i - x);
+            for (int k = w0; k <= w1; ++k)
+            {
+                int first = k == w0 ? y0 & 7 : 0;
+                int last = k == w1 ? ((y1 - 1) & 7) + 1 : IMAGE_ROWS_PER_WORD;
+                uint32_t both = opaqueNibbles(mine[k]) & opaqueNibbles(nibbleWindow(theirs, words, k * IMAGE_ROWS_PER_WORD - y));
+                if (both & spanMask(first, last))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Copy the non-zero pixels of another image on top of this one
+    void drawTransparentImage(const Image &from, int x, int y)
+    {
+        blitMasked(from, nullptr, x, y);
+    }
+
+    // Like drawTransparentImage, with the mask from `from.opaqueMask()` instead of testing each pixel
+    void drawMaskedImage(const Image &from, const uint32_t *mask, int x, int y)
+    {
+        blitMasked(from, mask, x, y);
+    }
+
+    // Copy area `r` of an image of the same height to the same place in this one
+    void copyRect(const Image &from, const DirtyRect &r)
+    {
+        int x0 = std::max((int)r.x0, 0), x1 = std::min({(int)r.x1, width, from.width});
+        int y0 = std::max((int)r.y0, 0), y1 = std::min((int)r.y1, height);
+        if (from.height != height || x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+        markDirty(x0, y0, x1, y1);
+        int w0 = y0 >> 3, w1 = (y1 - 1) >> 3;
+        uint32_t head = spanMask(y0 & 7, w0 == w1 ? ((y1 - 1) & 7) + 1 : IMAGE_ROWS_PER_WORD);
+        uint32_t tail = spanMask(0, ((y1 - 1) & 7) + 1);
+        for (int i = x0; i < x1; ++i)
+        {
+            uint32_t *dst = column(i);
+            const uint32_t *src = from.column(i);
+            storeMasked(dst + w0, src[w0], head);
+            if (w1 > w0)
+            {
+                copyWords(dst + w0 + 1, src + w0 + 1, w1 - w0 - 1);
+                storeMasked(dst + w1, src[w1], tail);
             }
         }
     }
@@ -88,7 +665,8 @@ public:
     {
         if (x >= 0 && x < width && y >= 0 && y < height)
         {
-            pixels[y][x] = color;
+            setPixelUnchecked(x, y, color);
+            markDirty(x, y, x + 1, y + 1);
         }
     }
 
@@ -97,7 +675,7 @@ public:
     {
         if (x >= 0 && x < width && y >= 0 && y < height)
         {
-            return pixels[y][x];
+            return getPixelUnchecked(x, y);
         }
         return 0; // Default to black if out of bounds
     }
@@ -105,75 +683,407 @@ public:
     // Fill entire image with a color
     void fill(uint32_t color)
     {
-        for (int i = 0; i < height; ++i)
-        {
-            for (int j = 0; j < width; ++j)
-            {
-                pixels[i][j] = color;
-            }
-        }
+        color &= IMAGE_COLOR_MASK;
+        memset(bytes(), color | (color << 4), byteLength());
+        markDirty(0, 0, width, height);
     }
 
     // Clone the image
     Image clone() const
     {
         Image copy(width, height);
-        copy.pixels = pixels;
-        return copy;
+        copy.buffer = buffer;
+        return copy; // All dirty, like any new image
     }
 
-    // Flip horizontally
+    // Copy another image into this one, reusing this one's buffer when the sizes match
+    void copyFrom(const Image &from)
+    {
+        width = from.width;
+        height = from.height;
+        byteHeight = from.byteHeight;
+        buffer = from.buffer;
+        markDirty(0, 0, width, height);
+    }
+
+    // Flip horizontally: columns are contiguous, so swap them whole
     void flipX()
     {
-        for (int i = 0; i < height; ++i)
+        for (int i = 0, j = width - 1; i < j; ++i, --j)
         {
-            std::reverse(pixels[i].begin(), pixels[i].end());
+            std::swap_ranges(bytes() + i * byteHeight, bytes() + (i + 1) * byteHeight, bytes() + j * byteHeight);
         }
+        markDirty(0, 0, width, height);
     }
 
-    // Flip vertically
+    // Flip vertically: reverse each column's words and their nibbles, then drop the padding back to the end
     void flipY()
     {
-        std::reverse(pixels.begin(), pixels.end());
+        int words = byteHeight >> 2;
+        int padding = words * IMAGE_ROWS_PER_WORD - height;
+        for (int x = 0; x < width; ++x)
+        {
+            uint32_t *col = column(x);
+            std::reverse(col, col + words);
+            for (int w = 0; w < words; ++w)
+            {
+                col[w] = reverseNibbles(col[w]);
+            }
+            if (padding)
+            {
+                shiftColumn(col, words, -padding);
+            }
+        }
+        markDirty(0, 0, width, height);
     }
 
-    // Scroll (translate pixels)
-    void scroll(int dx, int dy)
+    // Scroll (translate pixels) in place, filling the area uncovered with `color`
+    void scroll(int dx, int dy, uint32_t color = 0)
     {
-        std::vector<std::vector<uint32_t>> newPixels(height, std::vector<uint32_t>(width, 0));
-        for (int i = 0; i < height; ++i)
+        if (dx == 0 && dy == 0)
+        {
+            return;
+        }
+        if (abs(dx) >= width || abs(dy) >= height)
+        {
+            fill(color);
+            return;
+        }
+
+        // Columns are contiguous, so moving sideways is one memmove
+        uint8_t pattern = nibbles(color) & 0xFF;
+        int kept = width - abs(dx);
+        if (dx > 0)
         {
-            for (int j = 0; j < width; ++j)
+            memmove(bytes() + dx * byteHeight, bytes(), kept * byteHeight);
+            memset(bytes(), pattern, dx * byteHeight);
+        }
+        else if (dx < 0)
+        {
+            memmove(bytes(), bytes() - dx * byteHeight, kept * byteHeight);
+            memset(bytes() + kept * byteHeight, pattern, -dx * byteHeight);
+        }
+
+        if (dy)
+        {
+            int words = byteHeight >> 2;
+            for (int x = std::max(dx, 0); x < std::max(dx, 0) + kept; ++x)
+            {
+                shiftColumn(column(x), words, dy);
+                fillColumn(column(x), dy > 0 ? 0 : height + dy, dy > 0 ? dy : height, nibbles(color));
+            }
+        }
+        markDirty(0, 0, width, height);
+    }
+
+    /**
+     * Write this image turned about its main diagonal into `dst`, which must be `height` x `width`.
+     * Works on 8 x 8 pixel blocks: 8 column words in, 8 column words out.
+     * @return `false` if `dst` is the wrong size.
+     */
+    bool transposeInto(Image &dst) const
+    {
+        if (dst.width != height || dst.height != width)
+        {
+            return false;
+        }
+        int words = byteHeight >> 2;
+        for (int bx = 0; bx < width; bx += IMAGE_ROWS_PER_WORD)
+        {
+            for (int wy = 0; wy < words; ++wy)
             {
-                int newX = j + dx;
-                int newY = i + dy;
-                if (newX >= 0 && newX < width && newY >= 0 && newY < height)
+                uint32_t in[IMAGE_ROWS_PER_WORD];
+                for (int c = 0; c < IMAGE_ROWS_PER_WORD; ++c)
+                {
+                    in[c] = bx + c < width ? column(bx + c)[wy] : 0;
+                }
+                for (int r = 0; r < IMAGE_ROWS_PER_WORD && wy * IMAGE_ROWS_PER_WORD + r < height; ++r)
                 {
-                    newPixels[newY][newX] = pixels[i][j];
+                    uint32_t out = 0;
+                    for (int c = 0; c < IMAGE_ROWS_PER_WORD; ++c)
+                    {
+                        out |= ((in[c] >> (r * 4)) & 0xF) << (c * 4);
+                    }
+                    dst.column(wy * IMAGE_ROWS_PER_WORD + r)[bx >> 3] = out;
                 }
             }
         }
-        pixels = newPixels;
+        dst.markDirty(0, 0, dst.width, dst.height);
+        return true;
     }
 
-    // Replace one color with another
-    void replace(uint32_t from, uint32_t to)
+    /**
+     * Scale this image (nearest neighbour) to fill `dst`, whatever its size. Repeated columns
+     * are copied whole, and doubling the height expands a word at a time.
+     */
+    void scaleInto(Image &dst) const
     {
-        for (int i = 0; i < height; ++i)
+        int words = dst.byteHeight >> 2;
+        bool doubled = dst.height == height * 2;
+        for (int x = 0; x < dst.width; ++x)
         {
-            for (int j = 0; j < width; ++j)
+            int sx = x * width / dst.width;
+            uint32_t *out = dst.column(x);
+            if (x > 0 && sx == (x - 1) * width / dst.width)
             {
-                if (pixels[i][j] == from)
+                memcpy(out, dst.column(x - 1), dst.byteHeight);
+                continue;
+            }
+            const uint32_t *src = column(sx);
+            for (int w = 0; w < words; ++w)
+            {
+                if (doubled)
                 {
-                    pixels[i][j] = to;
+                    out[w] = doubleNibbles(src[w >> 1] >> ((w & 1) * 16));
+                    continue;
                 }
+                uint32_t value = 0;
+                for (int n = 0; n < IMAGE_ROWS_PER_WORD && w * IMAGE_ROWS_PER_WORD + n < dst.height; ++n)
+                {
+                    value |= getPixelUnchecked(sx, (w * IMAGE_ROWS_PER_WORD + n) * height / dst.height) << (n * 4);
+                }
+                out[w] = value;
             }
         }
+        dst.markDirty(0, 0, dst.width, dst.height);
     }
 
-    // Check if two images are equal
+    // Replace one color with another, 8 pixels per word (column padding may change too)
+    void replace(uint32_t from, uint32_t to)
+    {
+        if (from > IMAGE_COLOR_MASK || (from & IMAGE_COLOR_MASK) == (to & IMAGE_COLOR_MASK))
+        {
+            return;
+        }
+        uint32_t match = nibbles(from), value = nibbles(to);
+        uint32_t changed = 0;
+        for (uint32_t &word : buffer)
+        {
+            // Matching nibbles become 0; the top bit of each nibble then flags which ones did
+            uint32_t diff = word ^ match;
+            uint32_t zero = ~(((diff & 0x77777777u) + 0x77777777u) | diff) & 0x88888888u;
+            storeMasked(&word, value, (zero >> 3) * 0xF);
+            changed |= zero;
+        }
+        if (changed)
+        {
+            markDirty(0, 0, width, height);
+        }
+    }
+
+    // Check if two images are equal (the padding at the end of each column doesn't count)
     bool equals(const Image &other) const
     {
-        return width == other.width && height == other.height && pixels == other.pixels;
+        if (width != other.width || height != other.height)
+        {
+            return false;
+        }
+        int fullBytes = height >> 1;
+        for (int x = 0; x < width; ++x)
+        {
+            if (memcmp(pix(x, 0), other.pix(x, 0), fullBytes) != 0)
+            {
+                return false;
+            }
+            if ((height & 1) && getPixelUnchecked(x, height - 1) != other.getPixelUnchecked(x, height - 1))
+            {
+                return false;
+            }
+        }
+        return true;
     }
 };
+
+namespace image
+{
+    // Time a kernel over `iterations` calls and return pixels per second
+    template <typename F>
+    uint64_t pixelRate(uint64_t pixelsPerCall, int32_t iterations, F kernel)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int32_t i = 0; i < iterations; i++)
+        {
+            kernel(i);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        return elapsed > 0 ? pixelsPerCall * iterations * 1000000 / elapsed : 0;
+    }
+
+    /**
+     * Run the word kernels and the pixel at a time loops they replaced over a 160x120 screen,
+     * printing pixels per second for each.
+     * @return `false` if any kernel's output differs from the pixel loop's.
+     */
+    inline bool BenchmarkKernels(int32_t iterations)
+    {
+        const int w = 160, h = 120;
+        Image fast(w, h), slow(w, h);
+        std::vector<uint8_t> icon(16 * 16);
+        for (size_t i = 0; i < icon.size(); i++)
+        {
+            icon[i] = (i * 7) % 3 == 0;
+        }
+        Image sprite(24, 20);
+        for (int x = 0; x < 24; x++)
+        {
+            for (int y = 0; y < 20; y++)
+            {
+                sprite.setPixel(x, y, (x + y) % 15 + 1);
+            }
+        }
+
+        // Odd offsets keep the rectangles off word boundaries
+        auto rectAt = [](int32_t i, int &x, int &y) {
+            x = (i * 37) % 170 - 10;
+            y = (i * 13) % 130 - 10;
+        };
+
+        uint64_t slowRect = pixelRate(40 * 30, iterations, [&](int32_t i) {
+            int x, y;
+            rectAt(i, x, y);
+            for (int r = y; r < y + 30; ++r)
+                for (int c = x; c < x + 40; ++c)
+                    slow.setPixel(c, r, i);
+        });
+        uint64_t fastRect = pixelRate(40 * 30, iterations, [&](int32_t i) {
+            int x, y;
+            rectAt(i, x, y);
+            fast.fillRect(x, y, 40, 30, i);
+        });
+        bool same = fast.equals(slow);
+
+        uint64_t slowReplace = pixelRate(w * h, iterations, [&](int32_t i) {
+            for (int r = 0; r < h; ++r)
+                for (int c = 0; c < w; ++c)
+                    if (slow.getPixel(c, r) == (uint32_t)(i & 15))
+                        slow.setPixel(c, r, i + 1);
+        });
+        uint64_t fastReplace = pixelRate(w * h, iterations, [&](int32_t i) { fast.replace(i & 15, i + 1); });
+        same = same && fast.equals(slow);
+
+        uint64_t slowIcon = pixelRate(icon.size(), iterations, [&](int32_t i) {
+            int x, y;
+            rectAt(i, x, y);
+            for (int r = 0; r < 16; ++r)
+                for (int c = 0; c < 16; ++c)
+                    if (icon[r * 16 + c] != 0)
+                        slow.setPixel(x + c, y + r, i);
+        });
+        uint64_t fastIcon = pixelRate(icon.size(), iterations, [&](int32_t i) {
+            int x, y;
+            rectAt(i, x, y);
+            fast.drawIcon(icon, 16, 16, x, y, i);
+        });
+        same = same && fast.equals(slow);
+
+        uint64_t slowBlit = pixelRate(24 * 20, iterations, [&](int32_t i) {
+            int x, y;
+            rectAt(i, x, y);
+            for (int r = 0; r < 20; ++r)
+                for (int c = 0; c < 24; ++c)
+                    slow.setPixel(x + c, y + r, sprite.getPixel(c, r));
+        });
+        uint64_t fastBlit = pixelRate(24 * 20, iterations, [&](int32_t i) {
+            int x, y;
+            rectAt(i, x, y);
+            fast.drawImage(sprite, x, y);
+        });
+        same = same && fast.equals(slow);
+
+        std::cout << "Image: pixels/s, per pixel -> word kernels\n"
+                  << "  fillRect  " << slowRect << " -> " << fastRect << "\n"
+                  << "  replace   " << slowReplace << " -> " << fastReplace << "\n"
+                  << "  drawIcon  " << slowIcon << " -> " << fastIcon << "\n"
+                  << "  drawImage " << slowBlit << " -> " << fastBlit << "\n"
+                  << "  output " << (same ? "matches" : "DIFFERS") << "\n";
+        return same;
+    }
+
+    // Time `op` over `iterations` calls; report nanoseconds and Image buffer allocations per call
+    template <typename F>
+    void timeTransform(const char *name, int32_t iterations, F op)
+    {
+        uint32_t allocated = Image::allocations();
+        auto start = std::chrono::steady_clock::now();
+        for (int32_t i = 0; i < iterations; i++)
+        {
+            op(i);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << name << " " << (iterations ? elapsed / iterations : 0) << " ns, "
+                  << (iterations ? (double)(Image::allocations() - allocated) / iterations : 0) << " allocations\n";
+    }
+
+    /**
+     * Time scroll, flipY, transpose and doubling on a 160x120 screen against the pixel at a time
+     * versions they replaced, which built a new image per call.
+     * @return `false` if any result differs from the pixel loop's.
+     */
+    inline bool BenchmarkTransforms(int32_t iterations)
+    {
+        const int w = 160, h = 120;
+        Image fast(w, h), slow(w, h);
+        for (int x = 0; x < w; x++)
+        {
+            for (int y = 0; y < h; y++)
+            {
+                fast.setPixel(x, y, (x * 3 + y * 7) % 16);
+            }
+        }
+        slow.copyFrom(fast);
+
+        auto slowScroll = [&](int dx, int dy) {
+            Image moved(w, h);
+            for (int y = 0; y < h; ++y)
+                for (int x = 0; x < w; ++x)
+                    moved.setPixel(x + dx, y + dy, slow.getPixel(x, y));
+            slow = std::move(moved);
+        };
+        auto slowTranspose = [&]() {
+            Image t(h, w);
+            for (int y = 0; y < h; ++y)
+                for (int x = 0; x < w; ++x)
+                    t.setPixel(y, x, slow.getPixel(x, y));
+            return t;
+        };
+
+        Image transposed(h, w), doubled(w * 2, h * 2);
+        bool same = true;
+        std::cout << "Image transforms, per call:\n";
+        timeTransform("scroll x, per pixel  ", iterations, [&](int32_t i) { slowScroll(i & 1 ? 1 : -1, 0); });
+        timeTransform("scroll x, in place   ", iterations, [&](int32_t i) { fast.scroll(i & 1 ? 1 : -1, 0); });
+        same = same && fast.equals(slow);
+        timeTransform("scroll y, per pixel  ", iterations, [&](int32_t i) { slowScroll(0, i & 1 ? 3 : -3); });
+        timeTransform("scroll y, in place   ", iterations, [&](int32_t i) { fast.scroll(0, i & 1 ? 3 : -3); });
+        same = same && fast.equals(slow);
+        timeTransform("flipY, per pixel     ", iterations, [&](int32_t) {
+            for (int x = 0; x < w; ++x)
+                for (int i = 0, j = h - 1; i < j; ++i, --j)
+                {
+                    uint32_t top = slow.getPixel(x, i);
+                    slow.setPixel(x, i, slow.getPixel(x, j));
+                    slow.setPixel(x, j, top);
+                }
+        });
+        timeTransform("flipY, in place      ", iterations, [&](int32_t) { fast.flipY(); });
+        same = same && fast.equals(slow);
+        Image expected = slowTranspose();
+        timeTransform("transpose, per pixel ", iterations, [&](int32_t) { slowTranspose(); });
+        timeTransform("transpose, into dst  ", iterations, [&](int32_t) { fast.transposeInto(transposed); });
+        same = same && transposed.equals(expected);
+        timeTransform("doubled, per pixel   ", iterations, [&](int32_t) {
+            Image d(w * 2, h * 2);
+            for (int y = 0; y < h * 2; ++y)
+                for (int x = 0; x < w * 2; ++x)
+                    d.setPixel(x, y, slow.getPixel(x / 2, y / 2));
+            expected = std::move(d);
+        });
+        timeTransform("doubled, into dst    ", iterations, [&](int32_t) { fast.scaleInto(doubled); });
+        same = same && doubled.equals(expected);
+
+        std::cout << "  output " << (same ? "matches" : "DIFFERS") << "\n";
+        return same;
+    }
+}
+
+#endif // IMAGE_D_CPP
@@ -7,7 +7,8 @@ class Image
 {
 private:
     int32_t width, height;
-    std::vector<std::vector<int32_t>> pixels; // 2D array for pixel data
+    int32_t byteHeight;           // Bytes per column (the stride), word aligned
+    std::vector<uint32_t> buffer; // Column-major 4bpp palette indices, even row in the low nibble
 
 public:
     // Constructor
@@ -17,6 +18,15 @@ public:
     int32_t getWidth() const;
     int32_t getHeight() const;
     bool isMono() const;
+    int32_t stride() const;
+
+    // Raw pixel storage in the display's native format
+    uint8_t *pix(int32_t x, int32_t y);
+
+    // Areas changed since the last display push
+    void markDirty(int32_t x0, int32_t y0, int32_t x1, int32_t y1);
+    int32_t getDirtyCount() const;
+    void clearDirty();
 
     // Methods
     void copyFrom(const Image &from);
@@ -29,12 +39,15 @@ public:
     void flipX();
     void flipY();
     std::shared_ptr<Image> transposed() const;
-    void scroll(int32_t dx, int32_t dy);
+    bool transposeInto(Image &dst) const;
+    void scaleInto(Image &dst) const;
+    void scroll(int32_t dx, int32_t dy, int32_t c = 0);
     std::shared_ptr<Image> doubledX() const;
     std::shared_ptr<Image> doubledY() const;
     void replace(int32_t from, int32_t to);
     std::shared_ptr<Image> doubled() const;
     void drawImage(const Image &from, int32_t x, int32_t y);
+    void drawImagePart(const Image &from, int32_t sx, int32_t sy, int32_t w, int32_t h, int32_t x, int32_t y);
     void drawTransparentImage(const Image &from, int32_t x, int32_t y);
     bool overlapsWith(const Image &other, int32_t x, int32_t y) const;
 };
@@ -45,4 +58,6 @@ namespace image
     std::shared_ptr<Image> create(int32_t width, int32_t height);
     std::shared_ptr<Image> ofBuffer(const Buffer &buf);
     std::shared_ptr<Buffer> doubledIcon(const Buffer &icon);
+    bool BenchmarkKernels(int32_t iterations); // Word kernels against per-pixel loops, host side
+    bool BenchmarkTransforms(int32_t iterations); // In-place transforms against per-pixel copies, host side
 }
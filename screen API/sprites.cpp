@@ -0,0 +1,163 @@
+#include "sprites.h"
+#include "tilemap.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace screen
+{
+    SpriteImage::SpriteImage(const Image &image) : image(&image)
+    {
+        update();
+    }
+
+    void SpriteImage::update()
+    {
+        opaque = image->opaqueMask(mask) == image->getWidth() * image->getHeight();
+    }
+
+    void SpriteImage::drawTo(Image &target, int x, int y) const
+    {
+        if (opaque)
+        {
+            target.drawImage(*image, x, y);
+        }
+        else
+        {
+            target.drawMaskedImage(*image, mask.data(), x, y);
+        }
+    }
+
+    SpriteBatch::SpriteBatch(size_t capacity) : capacity(std::min<size_t>(capacity, 0x10000))
+    {
+        commands.reserve(this->capacity);
+        order.reserve(this->capacity);
+        drawn.reserve(this->capacity);
+    }
+
+    bool SpriteBatch::draw(const SpriteImage &sprite, int x, int y, int16_t z)
+    {
+        if (commands.size() >= capacity)
+        {
+            stats.dropped++;
+            return false;
+        }
+        // Unsigned keys sort by layer first, then by queue position, so one plain sort is stable
+        order.push_back((uint32_t)(z + 0x8000) << 16 | commands.size());
+        commands.push_back({&sprite, (int16_t)x, (int16_t)y});
+        stats.submitted++;
+        return true;
+    }
+
+    int SpriteBatch::flush(Image &target)
+    {
+        std::sort(order.begin(), order.end());
+        drawn.clear();
+        int width = target.getWidth(), height = target.getHeight();
+        for (uint32_t key : order)
+        {
+            const Command &c = commands[key & 0xFFFF];
+            const Image &image = c.sprite->getImage();
+            DirtyRect r = {(int16_t)std::max<int>(c.x, 0), (int16_t)std::max<int>(c.y, 0),
+                           (int16_t)std::min(c.x + image.getWidth(), width), (int16_t)std::min(c.y + image.getHeight(), height)};
+            if (r.x0 >= r.x1 || r.y0 >= r.y1)
+            {
+                continue;
+            }
+            c.sprite->drawTo(target, c.x, c.y);
+            drawn.push_back(r);
+        }
+        commands.clear();
+        order.clear();
+        stats.frames++;
+        stats.drawn += drawn.size();
+        return drawn.size();
+    }
+
+    void SpriteBatch::restore(TileMap &background) const
+    {
+        for (const DirtyRect &r : drawn)
+        {
+            background.invalidate(r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+        }
+    }
+
+    bool BenchmarkSprites(int32_t frames)
+    {
+        const int w = 160, h = 120, size = 16, count = 200;
+        const int64_t frameUs = 1000000 / 60;
+        Image fast(w, h), slow(w, h);
+
+        // A disc with a ring of see-through pixels, so the mask matters
+        Image art(size, size);
+        for (int x = 0; x < size; x++)
+        {
+            for (int y = 0; y < size; y++)
+            {
+                int dx = 2 * x - size + 1, dy = 2 * y - size + 1, d = dx * dx + dy * dy;
+                art.setPixel(x, y, d < size * size && (d < size * size / 4 || d > size * size / 2) ? (x + y) % 15 + 1 : 0);
+            }
+        }
+        SpriteImage sprite(art);
+        SpriteBatch batch(count);
+
+        // Positions that wander off every edge; layers out of order
+        auto place = [](int32_t frame, int i, int &x, int &y, int16_t &z) {
+            x = (i * 37 + frame * 3) % (w + size) - size / 2;
+            y = (i * 53 + frame * 5) % (h + size) - size / 2;
+            z = (i * 7) % 5;
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        for (int32_t f = 0; f < frames; f++)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                int x, y;
+                int16_t z;
+                place(f, i, x, y, z);
+                batch.draw(sprite, x, y, z);
+            }
+            batch.flush(fast);
+        }
+        int64_t batchedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (int32_t f = 0; f < frames; f++)
+        {
+            for (int16_t layer = 0; layer < 5; layer++)
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    int x, y;
+                    int16_t z;
+                    place(f, i, x, y, z);
+                    if (z != layer)
+                    {
+                        continue;
+                    }
+                    for (int c = 0; c < size; c++)
+                    {
+                        for (int r = 0; r < size; r++)
+                        {
+                            uint32_t color = art.getPixel(c, r);
+                            if (color)
+                            {
+                                slow.setPixel(x + c, y + r, color);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        int64_t pixelUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        bool same = fast.equals(slow);
+        auto perFrame = [&](int64_t us) { return us > 0 ? frameUs * count * frames / us : 0; };
+        std::cout << "Sprites: " << size << "x" << size << ", " << count << " per frame, sprites per 60 FPS frame\n"
+                  << "  per pixel " << perFrame(pixelUs) << "\n"
+                  << "  batched   " << perFrame(batchedUs) << "\n"
+                  << "  output " << (same ? "matches" : "DIFFERS") << "\n";
+        return same;
+    }
+}
@@ -0,0 +1,235 @@
+#include "tilemap.h"
+#include <cstdlib>
+
+namespace screen
+{
+    TileMap::TileMap(const Image &sheet, int tileSize, int columns, int rows)
+        : sheet(&sheet), tileShift(0), columns(columns), rows(rows),
+          tiles(columns * rows, TILEMAP_NO_TILE), changed((columns * rows + 31) >> 5, 0)
+    {
+        while ((1 << (tileShift + 1)) <= tileSize)
+        {
+            tileShift++;
+        }
+    }
+
+    void TileMap::setSheet(const Image &sheet)
+    {
+        this->sheet = &sheet;
+        drawn = false;
+    }
+
+    uint8_t TileMap::getTile(int column, int row) const
+    {
+        if (column < 0 || column >= columns || row < 0 || row >= rows)
+        {
+            return TILEMAP_NO_TILE;
+        }
+        return tiles[row * columns + column];
+    }
+
+    void TileMap::setTile(int column, int row, uint8_t index)
+    {
+        if (column < 0 || column >= columns || row < 0 || row >= rows)
+        {
+            return;
+        }
+        int cell = row * columns + column;
+        if (tiles[cell] != index)
+        {
+            tiles[cell] = index;
+            changed[cell >> 5] |= 1u << (cell & 31);
+        }
+    }
+
+    void TileMap::setTiles(const uint8_t *indices)
+    {
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int column = 0; column < columns; ++column)
+            {
+                setTile(column, row, *indices++);
+            }
+        }
+    }
+
+    void TileMap::setBackground(uint8_t color)
+    {
+        if (color != background)
+        {
+            background = color;
+            drawn = false;
+        }
+    }
+
+    void TileMap::setScroll(int x, int y)
+    {
+        scrollX = x;
+        scrollY = y;
+    }
+
+    void TileMap::invalidate(int x, int y, int w, int h)
+    {
+        if (w > 0 && h > 0)
+        {
+            markArea(x + drawnX, y + drawnY, x + w + drawnX, y + h + drawnY);
+        }
+    }
+
+    bool TileMap::isChanged(int column, int row) const
+    {
+        int cell = row * columns + column;
+        return changed[cell >> 5] & (1u << (cell & 31));
+    }
+
+    // Flag the cells under an area of the map, in map pixels; what lies off the map goes to `outside`
+    void TileMap::markArea(int x0, int y0, int x1, int y1)
+    {
+        int c0 = std::max(x0 >> tileShift, 0), c1 = std::min((x1 - 1) >> tileShift, columns - 1);
+        int r0 = std::max(y0 >> tileShift, 0), r1 = std::min((y1 - 1) >> tileShift, rows - 1);
+        for (int row = r0; row <= r1; ++row)
+        {
+            for (int column = c0; column <= c1; ++column)
+            {
+                int cell = row * columns + column;
+                changed[cell >> 5] |= 1u << (cell & 31);
+            }
+        }
+
+        if (x0 < 0 || y0 < 0 || x1 > columns << tileShift || y1 > rows << tileShift)
+        {
+            if (outside.x0 >= outside.x1)
+            {
+                outside = {(int16_t)x0, (int16_t)y0, (int16_t)x1, (int16_t)y1};
+            }
+            else
+            {
+                outside = {(int16_t)std::min<int>(outside.x0, x0), (int16_t)std::min<int>(outside.y0, y0),
+                           (int16_t)std::max<int>(outside.x1, x1), (int16_t)std::max<int>(outside.y1, y1)};
+            }
+        }
+    }
+
+    // Paint the background over the parts of `outside` around the map: the bands above and below it, then beside it
+    void TileMap::fillOutside(Image &target)
+    {
+        int x0 = outside.x0, y0 = outside.y0, x1 = outside.x1, y1 = outside.y1;
+        int mapWidth = columns << tileShift, mapHeight = rows << tileShift;
+        int top = std::min(y1, 0), bottom = std::max(y0, mapHeight);
+        if (y0 < top)
+        {
+            target.fillRect(x0 - scrollX, y0 - scrollY, x1 - x0, top - y0, background);
+        }
+        if (bottom < y1)
+        {
+            target.fillRect(x0 - scrollX, bottom - scrollY, x1 - x0, y1 - bottom, background);
+        }
+        int middle0 = std::max(y0, 0), middle1 = std::min(y1, mapHeight);
+        if (middle0 < middle1)
+        {
+            if (x0 < 0)
+            {
+                target.fillRect(x0 - scrollX, middle0 - scrollY, std::min(x1, 0) - x0, middle1 - middle0, background);
+            }
+            if (x1 > mapWidth)
+            {
+                int left = std::max(x0, mapWidth);
+                target.fillRect(left - scrollX, middle0 - scrollY, x1 - left, middle1 - middle0, background);
+            }
+        }
+        outside = {};
+    }
+
+    // Draw the cells `first` to `last` of a row; empty neighbours share one fill
+    void TileMap::drawRun(Image &target, int row, int first, int last)
+    {
+        int size = 1 << tileShift;
+        int count = sheet->getHeight() >> tileShift;
+        int y = (row << tileShift) - scrollY;
+        const uint8_t *cells = &tiles[row * columns];
+        for (int column = first; column <= last; ++column)
+        {
+            int x = (column << tileShift) - scrollX;
+            if (cells[column] < count)
+            {
+                target.drawImagePart(*sheet, 0, cells[column] << tileShift, size, size, x, y);
+                continue;
+            }
+            int end = column;
+            while (end < last && cells[end + 1] >= count)
+            {
+                end++;
+            }
+            target.fillRect(x, y, (end - column + 1) << tileShift, size, background);
+            column = end;
+        }
+        stats.tilesDrawn += last - first + 1;
+        stats.runs++;
+    }
+
+    void TileMap::render(Image &target)
+    {
+        int width = target.getWidth(), height = target.getHeight();
+        int dx = scrollX - drawnX, dy = scrollY - drawnY;
+        uint32_t before = stats.tilesDrawn;
+
+        if (!drawn || width != drawnWidth || height != drawnHeight || abs(dx) >= width || abs(dy) >= height)
+        {
+            markArea(scrollX, scrollY, scrollX + width, scrollY + height);
+        }
+        else if (dx || dy)
+        {
+            // Move the last frame into place; only the strips it uncovered need drawing
+            target.scroll(-dx, -dy, background);
+            stats.scrolls++;
+            if (dx)
+            {
+                int x0 = dx > 0 ? scrollX + width - dx : scrollX;
+                markArea(x0, scrollY, x0 + abs(dx), scrollY + height);
+            }
+            if (dy)
+            {
+                int y0 = dy > 0 ? scrollY + height - dy : scrollY;
+                markArea(scrollX, y0, scrollX + width, y0 + abs(dy));
+            }
+        }
+
+        if (outside.x0 < outside.x1)
+        {
+            fillOutside(target);
+        }
+
+        // Visible cells, a row at a time, in runs of changed neighbours
+        int c0 = std::max(scrollX >> tileShift, 0), c1 = std::min((scrollX + width - 1) >> tileShift, columns - 1);
+        int r0 = std::max(scrollY >> tileShift, 0), r1 = std::min((scrollY + height - 1) >> tileShift, rows - 1);
+        for (int row = r0; row <= r1; ++row)
+        {
+            for (int column = c0; column <= c1; ++column)
+            {
+                if (!isChanged(column, row))
+                {
+                    continue;
+                }
+                int last = column;
+                while (last < c1 && isChanged(last + 1, row))
+                {
+                    last++;
+                }
+                drawRun(target, row, column, last);
+                column = last;
+            }
+        }
+
+        // Changed cells out of view are drawn when they scroll in, so nothing is carried over
+        std::fill(changed.begin(), changed.end(), 0);
+        drawn = true;
+        drawnX = scrollX;
+        drawnY = scrollY;
+        drawnWidth = width;
+        drawnHeight = height;
+        if (stats.tilesDrawn != before || dx || dy)
+        {
+            stats.frames++;
+        }
+    }
+}
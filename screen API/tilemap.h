@@ -0,0 +1,103 @@
+#ifndef TILEMAP_H
+#define TILEMAP_H
+
+#include <cstdint>
+#include <vector>
+#include "image.d.cpp"
+
+#define TILEMAP_NO_TILE 0xFF // Cell without a tile, painted in the background colour
+
+namespace screen
+{
+    struct TileMapStats
+    {
+        uint32_t frames;     // render() calls that drew anything
+        uint32_t tilesDrawn; // Tiles blitted, and empty cells filled
+        uint32_t runs;       // Runs of neighbouring cells in a row the tiles were drawn in
+        uint32_t scrolls;    // Frames that moved the last frame instead of redrawing it
+    };
+
+    /**
+     * @brief A scrolling background drawn from one shared tile sheet.
+     *
+     * The map keeps one byte per cell, plus one bit per cell for the cells changed since the last
+     * render(). render() expects the target to still hold the frame it drew last: it moves that
+     * frame by the scroll since, then draws only the tiles that changed or came into view.
+     * Whatever was drawn over the map in between (sprites, text) must be handed back with
+     * invalidate() so the tiles under it are drawn again.
+     */
+    class TileMap
+    {
+    private:
+        const Image *sheet;
+        int tileShift; // log2 of the tile size
+        int columns, rows;
+        std::vector<uint8_t> tiles;    // Row-major tile indices
+        std::vector<uint32_t> changed; // One bit per cell, same order
+        DirtyRect outside = {};        // Area off the map to paint, in map pixels
+        uint8_t background = 0;
+        int scrollX = 0, scrollY = 0;
+
+        // What the target held after the last render()
+        bool drawn = false;
+        int drawnX = 0, drawnY = 0, drawnWidth = 0, drawnHeight = 0;
+
+        TileMapStats stats = {};
+
+        bool isChanged(int column, int row) const;
+        void markArea(int x0, int y0, int x1, int y1);
+        void fillOutside(Image &target);
+        void drawRun(Image &target, int row, int first, int last);
+
+    public:
+        /**
+         * @param sheet Tiles stacked top to bottom, `tileSize` pixels wide; it must outlive the map.
+         * @param tileSize Width and height of a tile, a power of two.
+         * @param columns Map width in tiles.
+         * @param rows Map height in tiles.
+         */
+        TileMap(const Image &sheet, int tileSize, int columns, int rows);
+
+        void setSheet(const Image &sheet);
+        int getTileSize() const { return 1 << tileShift; }
+        int getColumns() const { return columns; }
+        int getRows() const { return rows; }
+
+        // Cells off the map read as TILEMAP_NO_TILE and ignore writes
+        uint8_t getTile(int column, int row) const;
+        void setTile(int column, int row, uint8_t index);
+
+        // Replace every cell from `columns` * `rows` row-major indices
+        void setTiles(const uint8_t *indices);
+
+        // Colour of empty cells and of the area around the map
+        void setBackground(uint8_t color);
+
+        // Map pixel shown at the target's top left corner
+        void setScroll(int x, int y);
+        int getScrollX() const { return scrollX; }
+        int getScrollY() const { return scrollY; }
+
+        /**
+         * @brief Have the next render() draw the map again under an area of the target.
+         *
+         * The area is in target pixels as of the last render(), where a sprite drawn after it was.
+         */
+        void invalidate(int x, int y, int w, int h);
+
+        // Draw the whole visible map on the next render()
+        void redraw() { drawn = false; }
+
+        /**
+         * @brief Bring `target` up to date with the map and the scroll offsets.
+         *
+         * Only the target's dirty rects for the cells drawn are marked, so an unchanged map costs
+         * nothing to draw or to push.
+         */
+        void render(Image &target);
+
+        const TileMapStats &getStats() const { return stats; }
+    };
+}
+
+#endif // TILEMAP_H
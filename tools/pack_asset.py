@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Pack an image into the RLE4 asset format read by screen::drawAsset (see "screen API/asset.h").
+
+Input is either a PNG (needs Pillow) or a text file holding a pxt image literal: one line per row,
+one character per pixel, '.' or '0'-'9' / 'a'-'f' for the palette index. PNG pixels are matched
+to the nearest colour of the Arcade palette, or of --palette; transparent ones become colour 0.
+
+    tools/pack_asset.py background.png -o background.rle4
+    tools/pack_asset.py hero.txt --c hero -o hero.h
+
+With --c the output is a C array to link into the firmware, where it stays in flash and is
+drawn from there.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"RLE4"
+HEADER_BYTES = 8
+LITERAL_MAX = 128
+RUN_SHORT_MAX = 8
+RUN_MAX = 264
+RUN_MIN = 3  # Shorter runs stay in literals, where they cost no more
+
+ARCADE_PALETTE = [
+    0x000000, 0xFFFFFF, 0xFF2121, 0xFF93C4, 0xFF8135, 0xFFF609, 0x249CA3, 0x78DC52,
+    0x003FAD, 0x87F2FF, 0x8E2EC4, 0xA4839F, 0x5C406C, 0xE5CDC4, 0x91463D, 0x000000,
+]
+
+
+def read_literal(path):
+    rows = []
+    with open(path) as f:
+        for line in f:
+            line = "".join(line.split())
+            if line:
+                rows.append([0 if c == "." else int(c, 16) for c in line])
+    if not rows or any(len(r) != len(rows[0]) for r in rows):
+        sys.exit("%s: rows must all be the same length" % path)
+    return [[rows[y][x] for y in range(len(rows))] for x in range(len(rows[0]))]
+
+
+def read_png(path, palette):
+    try:
+        from PIL import Image
+    except ImportError:
+        sys.exit("reading PNG needs Pillow (pip install pillow)")
+    image = Image.open(path).convert("RGBA")
+    width, height = image.size
+    pixels = image.load()
+    rgb = [((c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF) for c in palette]
+    nearest = {}
+
+    def index(pixel):
+        if pixel[3] < 128:
+            return 0
+        if pixel[:3] not in nearest:
+            # Colour 0 is transparent, so opaque pixels only match 1-15
+            nearest[pixel[:3]] = min(range(1, 16), key=lambda i: sum((a - b) ** 2 for a, b in zip(pixel[:3], rgb[i])))
+        return nearest[pixel[:3]]
+
+    return [[index(pixels[x, y]) for y in range(height)] for x in range(width)]
+
+
+def pack_column(column):
+    out = bytearray()
+    literal = []
+
+    def flush_literal():
+        while literal:
+            chunk = literal[:LITERAL_MAX]
+            del literal[:LITERAL_MAX]
+            out.append(len(chunk) - 1)
+            for i in range(0, len(chunk), 2):
+                out.append(chunk[i] | ((chunk[i + 1] if i + 1 < len(chunk) else 0) << 4))
+
+    y = 0
+    while y < len(column):
+        run = 1
+        while y + run < len(column) and run < RUN_MAX and column[y + run] == column[y]:
+            run += 1
+        if run < RUN_MIN:
+            literal.extend(column[y:y + run])
+        else:
+            flush_literal()
+            if run <= RUN_SHORT_MAX:
+                out.append(0x80 | ((run - 2) << 4) | column[y])
+            else:
+                out += bytes([0xF0 | column[y], run - RUN_SHORT_MAX - 1])
+        y += run
+    flush_literal()
+    return out
+
+
+def pack(columns):
+    width, height = len(columns), len(columns[0])
+    if width > 0xFFFF or height > 0xFFFF:
+        sys.exit("image too large")
+    codes = [pack_column(c) for c in columns]
+    offsets = [HEADER_BYTES + (width + 1) * 4]
+    for c in codes:
+        offsets.append(offsets[-1] + len(c))
+    return MAGIC + struct.pack("<HH", width, height) + struct.pack("<%dI" % len(offsets), *offsets) + b"".join(codes)
+
+
+def as_c(name, data):
+    lines = ["// Packed by tools/pack_asset.py; draw with screen::drawAsset", "#include <cstdint>", "",
+             "const uint8_t %s[%d] __attribute__((aligned(4))) = {" % (name, len(data))]
+    for i in range(0, len(data), 16):
+        lines.append("    " + ", ".join("0x%02X" % b for b in data[i:i + 16]) + ",")
+    lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("input", help="PNG, or text file with a pxt image literal")
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--c", metavar="NAME", help="write a C array called NAME instead of raw bytes")
+    parser.add_argument("--palette", help="16 comma separated RGB hex colours to match PNG pixels to")
+    args = parser.parse_args()
+
+    palette = ARCADE_PALETTE
+    if args.palette:
+        palette = [int(c, 16) for c in args.palette.split(",")]
+        if len(palette) != 16:
+            sys.exit("--palette needs 16 colours")
+
+    columns = read_png(args.input, palette) if args.input.lower().endswith(".png") else read_literal(args.input)
+    data = pack(columns)
+    if args.c:
+        with open(args.output, "w") as f:
+            f.write(as_c(args.c, data))
+    else:
+        with open(args.output, "wb") as f:
+            f.write(data)
+
+    raw = len(columns) * ((len(columns[0]) * 4 + 31) // 32 * 4)
+    print("%s: %dx%d, %d bytes packed, %d as an Image" % (args.output, len(columns), len(columns[0]), len(data), raw))
+
+
+if __name__ == "__main__":
+    main()